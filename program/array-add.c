@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+int src_a[MAGIC_TRIP], src_b[MAGIC_TRIP], dst[MAGIC_TRIP];
+
+// unrolled with -my-unroll-vector, the copies can be turned into vector
+// adds by running -slp-vectorizer after the pass (see PASSFLAGS)
+void MAGIC_FUNC (int * restrict c, const int * restrict a, const int * restrict b)
+{
+    int i;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+int main(void)
+{
+    int i, ret;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        src_a[i] = i;
+        src_b[i] = 2 * i;
+    }
+
+    HARNESS_MEASURE(MAGIC_FUNC (dst, src_a, src_b); do_not_optimize(dst));
+
+    ret = 0;
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        ret += dst[i];
+    }
+
+    printf("result: %d\n", ret);
+
+    return 0;
+}
@@ -1,7 +1,29 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <math.h>
+#include <sched.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// warm-up runs before the measured ones
+#ifndef HARNESS_WARMUP
+#define HARNESS_WARMUP 10
+#endif
+
+// measured runs, unless HARNESS_REPS is set in the environment
+#ifndef HARNESS_REPS
+#define HARNESS_REPS 1000
+#endif
 
 uint64_t rdtsc()
 {
@@ -10,4 +32,292 @@ uint64_t rdtsc()
     return ((uint64_t) hi << 32) | lo;
 }
 
+// reads the time stamp counter after all earlier instructions are done, and
+// before any later one starts
+uint64_t harness_start()
+{
+    unsigned int lo, hi;
+    __asm__ __volatile__("lfence\n\trdtsc\n\tlfence" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((uint64_t) hi << 32) | lo;
+}
+
+// reads the time stamp counter after the measured code is done. rdtscp waits
+// for earlier instructions, the lfence keeps later ones from starting early
+uint64_t harness_stop()
+{
+    unsigned int lo, hi, aux;
+    __asm__ __volatile__("rdtscp\n\tlfence" : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+    return ((uint64_t) hi << 32) | lo;
+}
+
+// keeps the compiler from removing the computation of a value that is
+// otherwise unused
+#define do_not_optimize(x) __asm__ __volatile__("" : : "g" (x) : "memory")
+
+// returns zeroed memory aligned to a cache line, or exits if there is none
+void *harness_alloc(size_t size)
+{
+    void *p;
+
+    if (posix_memalign(&p, 64, size) != 0) {
+        fprintf(stderr, "harness: cannot allocate %zu bytes\n", size);
+        exit(1);
+    }
+
+    memset(p, 0, size);
+    return p;
+}
+
+// fills a with pseudo-random values in [0, bound). the same seed gives the
+// same values in every build, so all variants compute the same result
+void harness_fill(int *a, unsigned n, unsigned bound, uint32_t seed)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        seed = seed * 1664525 + 1013904223;
+        a[i] = (seed >> 8) % bound;
+    }
+}
+
+// exits if the result of a kernel differs from the reference
+void harness_check(int ok, const char *name)
+{
+    if (!ok) {
+        fprintf(stderr, "harness: %s differs from the reference\n", name);
+        exit(1);
+    }
+}
+
+// pins the process to the cpu in HARNESS_CPU, or to the one it runs on, so
+// that the time stamp counter and the caches stay the same between runs
+void harness_pin()
+{
+    const char *env = getenv("HARNESS_CPU");
+    int cpu = env ? atoi(env) : sched_getcpu();
+    cpu_set_t set;
+
+    if (cpu < 0) {
+        return;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "harness: cannot pin to cpu %d\n", cpu);
+    }
+}
+
+// returns the number of measured runs
+unsigned harness_reps()
+{
+    const char *env = getenv("HARNESS_REPS");
+    int reps = env ? atoi(env) : HARNESS_REPS;
+    return reps > 0 ? reps : HARNESS_REPS;
+}
+
+// returns the cycles that a measurement of nothing takes
+uint64_t harness_overhead()
+{
+    uint64_t t0, t1, min = UINT64_MAX;
+    unsigned i;
+
+    for (i = 0; i < 1000; i++) {
+        t0 = harness_start();
+        t1 = harness_stop();
+        if (t1 - t0 < min) {
+            min = t1 - t0;
+        }
+    }
+
+    return min;
+}
+
+// hardware performance counters, counted in user space around the measured
+// runs. counters the kernel or the cpu does not offer are left out of the
+// report. uops have no generic event: HARNESS_UOPS_EVENT gives the raw
+// event, by default UOPS_ISSUED.ANY of intel cores, and 0 turns it off
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1I_MISSES,
+    COUNTER_UOPS,
+    NUM_COUNTERS
+};
+
+struct counter {
+    const char *name;
+    int fd;
+    double value;
+};
+
+struct counter counters[NUM_COUNTERS] = {
+    { "cycles", -1, 0 },
+    { "instructions", -1, 0 },
+    { "branch-misses", -1, 0 },
+    { "l1i-misses", -1, 0 },
+    { "uops", -1, 0 },
+};
+
+#ifdef __linux__
+int counter_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void counters_open()
+{
+#ifdef __linux__
+    const char *env = getenv("HARNESS_UOPS_EVENT");
+    uint64_t uops = env ? strtoull(env, NULL, 16) : 0x010e;
+
+    counters[COUNTER_CYCLES].fd = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters[COUNTER_INSTRUCTIONS].fd = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters[COUNTER_BRANCH_MISSES].fd = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters[COUNTER_L1I_MISSES].fd = counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                                                   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    if (uops != 0) {
+        counters[COUNTER_UOPS].fd = counter_open(PERF_TYPE_RAW, uops);
+    }
+#endif
+}
+
+void counters_start()
+{
+#ifdef __linux__
+    unsigned i;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (counters[i].fd >= 0) {
+            ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+// stops the counters and reads them. counters that shared the hardware with
+// others are scaled up to the time they were enabled
+void counters_stop()
+{
+#ifdef __linux__
+    uint64_t data[3];
+    unsigned i;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (counters[i].fd < 0) {
+            continue;
+        }
+
+        ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counters[i].fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+            close(counters[i].fd);
+            counters[i].fd = -1;
+            continue;
+        }
+        counters[i].value = (double) data[0] * data[1] / data[2];
+    }
+#endif
+}
+
+// prints the counters per run, and the instructions per cycle
+void counters_report(unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+        if (counters[i].fd >= 0) {
+            printf("%s: %.1f\n", counters[i].name, counters[i].value / n);
+        }
+    }
+
+    if (counters[COUNTER_CYCLES].fd >= 0 && counters[COUNTER_INSTRUCTIONS].fd >= 0 &&
+        counters[COUNTER_CYCLES].value > 0) {
+        printf("ipc: %.3f\n", counters[COUNTER_INSTRUCTIONS].value / counters[COUNTER_CYCLES].value);
+    }
+}
+
+int harness_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// prints the median as the time, with the minimum, the standard deviation
+// and a 95% confidence interval of the median. the interval is taken from
+// the order statistics, so it holds for any distribution of the samples
+void harness_report(uint64_t *samples, unsigned n)
+{
+    double mean = 0, var = 0, half;
+    unsigned i, lo, hi;
+
+    qsort(samples, n, sizeof(*samples), harness_compare);
+
+    for (i = 0; i < n; i++) {
+        mean += samples[i];
+    }
+    mean /= n;
+    for (i = 0; i < n; i++) {
+        var += (samples[i] - mean) * (samples[i] - mean);
+    }
+    var = n > 1 ? var / (n - 1) : 0;
+
+    half = 1.96 * sqrt(n) / 2;
+    lo = n / 2.0 - half < 0 ? 0 : (unsigned) (n / 2.0 - half);
+    hi = n / 2.0 + half >= n ? n - 1 : (unsigned) (n / 2.0 + half);
+
+    printf("time: %llu\n", (unsigned long long) samples[n / 2]);
+    printf("min: %llu\n", (unsigned long long) samples[0]);
+    printf("stddev: %.1f\n", sqrt(var));
+    printf("ci: %llu %llu\n", (unsigned long long) samples[lo],
+           (unsigned long long) samples[hi]);
+    printf("reps: %u\n", n);
+}
+
+// runs the statements HARNESS_WARMUP times, then harness_reps() times
+// measured, and prints the summary of the measured runs without the timing
+// overhead. the counters run over all measured runs, including the reads of
+// the time stamp counter
+#define HARNESS_MEASURE(...)                                            \
+    do {                                                                \
+        unsigned reps_ = harness_reps(), i_;                            \
+        uint64_t *samples_ = malloc(reps_ * sizeof(uint64_t));          \
+        uint64_t t0_, t1_, overhead_;                                   \
+                                                                        \
+        harness_pin();                                                  \
+        overhead_ = harness_overhead();                                 \
+        counters_open();                                                \
+        for (i_ = 0; i_ < HARNESS_WARMUP + reps_; i_++) {               \
+            if (i_ == HARNESS_WARMUP) {                                 \
+                counters_start();                                       \
+            }                                                           \
+            t0_ = harness_start();                                      \
+            __VA_ARGS__;                                                \
+            t1_ = harness_stop();                                       \
+            if (i_ >= HARNESS_WARMUP) {                                 \
+                t1_ -= t0_;                                             \
+                samples_[i_ - HARNESS_WARMUP] =                         \
+                    t1_ > overhead_ ? t1_ - overhead_ : 0;              \
+            }                                                           \
+        }                                                               \
+        counters_stop();                                                \
+        harness_report(samples_, reps_);                                \
+        counters_report(reps_);                                         \
+        free(samples_);                                                 \
+    } while (0)
+
 #endif /* HELPER_H */
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// element by element copy of an int array of MAGIC_TRIP elements, as memcpy
+// would do it
+
+void MAGIC_FUNC (int * restrict dst, const int * restrict src)
+{
+    int i;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        dst[i] = src[i];
+    }
+}
+
+int main(void)
+{
+    int *dst, *src, i;
+    long long ret;
+
+    dst = harness_alloc(MAGIC_TRIP * sizeof(int));
+    src = harness_alloc(MAGIC_TRIP * sizeof(int));
+    harness_fill(src, MAGIC_TRIP, 1000, 1);
+
+    HARNESS_MEASURE(MAGIC_FUNC (dst, src); do_not_optimize(dst));
+
+    harness_check(memcmp(dst, src, MAGIC_TRIP * sizeof(int)) == 0, "copy");
+
+    ret = 0;
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        ret += dst[i];
+    }
+
+    printf("result: %lld\n", ret);
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// dot product of two int arrays of MAGIC_TRIP elements
+
+long long MAGIC_FUNC (const int * restrict a, const int * restrict b)
+{
+    long long x;
+    int i;
+
+    x = 0;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        x += (long long) a[i] * b[i];
+    }
+
+    return x;
+}
+
+long long reference(const int *a, const int *b)
+{
+    long long x = 0;
+    int i;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        x += (long long) a[i] * b[i];
+    }
+
+    return x;
+}
+
+int main(void)
+{
+    int *a, *b;
+    long long ret;
+
+    a = harness_alloc(MAGIC_TRIP * sizeof(int));
+    b = harness_alloc(MAGIC_TRIP * sizeof(int));
+    harness_fill(a, MAGIC_TRIP, 1000, 1);
+    harness_fill(b, MAGIC_TRIP, 1000, 2);
+
+    ret = 0;
+    HARNESS_MEASURE(ret = MAGIC_FUNC (a, b); do_not_optimize(ret));
+
+    harness_check(ret == reference(a, b), "dot product");
+    printf("result: %lld\n", ret);
+
+    return 0;
+}
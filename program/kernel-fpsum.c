@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// sum of a double array of MAGIC_TRIP elements. the values are multiples of
+// 1/4 below 250, whose sums are exact in any order, so the result is the same
+// when the reduction is split or reassociated under fast-math
+
+double MAGIC_FUNC (const double *a)
+{
+    double x;
+    int i;
+
+    x = 0;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        x += a[i];
+    }
+
+    return x;
+}
+
+double reference(const double *a)
+{
+    double x = 0;
+    int i;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        x += a[i];
+    }
+
+    return x;
+}
+
+int main(void)
+{
+    double *a, ret;
+    int *v, i;
+
+    a = harness_alloc(MAGIC_TRIP * sizeof(double));
+    v = harness_alloc(MAGIC_TRIP * sizeof(int));
+    harness_fill(v, MAGIC_TRIP, 1000, 1);
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        a[i] = v[i] * 0.25;
+    }
+
+    ret = 0;
+    HARNESS_MEASURE(ret = MAGIC_FUNC (a); do_not_optimize(ret));
+
+    harness_check(ret == reference(a), "floating point sum");
+    printf("result: %lld\n", (long long) (ret * 4));
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// gathers every KERNEL_STRIDE-th element of an int array into MAGIC_TRIP
+// consecutive ones. with the default stride of 16 each load touches a cache
+// line of its own
+
+#ifndef KERNEL_STRIDE
+#define KERNEL_STRIDE 16
+#endif
+
+void MAGIC_FUNC (int * restrict dst, const int * restrict src)
+{
+    int i;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        dst[i] = src[i * KERNEL_STRIDE];
+    }
+}
+
+int main(void)
+{
+    int *dst, *src, i;
+    long long ret;
+
+    dst = harness_alloc(MAGIC_TRIP * sizeof(int));
+    src = harness_alloc((size_t) MAGIC_TRIP * KERNEL_STRIDE * sizeof(int));
+    harness_fill(src, MAGIC_TRIP * KERNEL_STRIDE, 1000, 1);
+
+    HARNESS_MEASURE(MAGIC_FUNC (dst, src); do_not_optimize(dst));
+
+    ret = 0;
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        harness_check(dst[i] == src[i * KERNEL_STRIDE], "strided gather");
+        ret += dst[i];
+    }
+
+    printf("result: %lld\n", ret);
+
+    return 0;
+}
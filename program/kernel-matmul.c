@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// multiplies a batch of small square int matrices, MAGIC_TRIP elements per
+// operand in total. the inner loops have the constant trip count
+// KERNEL_DIM, the outer one runs over the batch
+
+#ifndef KERNEL_DIM
+#define KERNEL_DIM 8
+#endif
+
+#define KERNEL_SIZE (KERNEL_DIM * KERNEL_DIM)
+#define KERNEL_BATCH (MAGIC_TRIP / KERNEL_SIZE > 0 ? MAGIC_TRIP / KERNEL_SIZE : 1)
+
+void MAGIC_FUNC (int * restrict c, const int * restrict a, const int * restrict b)
+{
+    int n, i, j, k, x;
+
+    for (n = 0; n < KERNEL_BATCH; n++) {
+        for (i = 0; i < KERNEL_DIM; i++) {
+            for (j = 0; j < KERNEL_DIM; j++) {
+                x = 0;
+                for (k = 0; k < KERNEL_DIM; k++) {
+                    x += a[n * KERNEL_SIZE + i * KERNEL_DIM + k] *
+                         b[n * KERNEL_SIZE + k * KERNEL_DIM + j];
+                }
+                c[n * KERNEL_SIZE + i * KERNEL_DIM + j] = x;
+            }
+        }
+    }
+}
+
+void reference(int *c, const int *a, const int *b)
+{
+    int n, i, j, k, x;
+
+    for (n = 0; n < KERNEL_BATCH; n++) {
+        for (i = 0; i < KERNEL_DIM; i++) {
+            for (j = 0; j < KERNEL_DIM; j++) {
+                x = 0;
+                for (k = 0; k < KERNEL_DIM; k++) {
+                    x += a[n * KERNEL_SIZE + i * KERNEL_DIM + k] *
+                         b[n * KERNEL_SIZE + k * KERNEL_DIM + j];
+                }
+                c[n * KERNEL_SIZE + i * KERNEL_DIM + j] = x;
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    int *a, *b, *c, *r, i;
+    long long ret;
+
+    a = harness_alloc(KERNEL_BATCH * KERNEL_SIZE * sizeof(int));
+    b = harness_alloc(KERNEL_BATCH * KERNEL_SIZE * sizeof(int));
+    c = harness_alloc(KERNEL_BATCH * KERNEL_SIZE * sizeof(int));
+    r = harness_alloc(KERNEL_BATCH * KERNEL_SIZE * sizeof(int));
+    harness_fill(a, KERNEL_BATCH * KERNEL_SIZE, 100, 1);
+    harness_fill(b, KERNEL_BATCH * KERNEL_SIZE, 100, 2);
+
+    HARNESS_MEASURE(MAGIC_FUNC (c, a, b); do_not_optimize(c));
+
+    reference(r, a, b);
+    harness_check(memcmp(c, r, KERNEL_BATCH * KERNEL_SIZE * sizeof(int)) == 0,
+                  "matrix multiply");
+
+    ret = 0;
+    for (i = 0; i < KERNEL_BATCH * KERNEL_SIZE; i++) {
+        ret += c[i];
+    }
+
+    printf("result: %lld\n", ret);
+
+    return 0;
+}
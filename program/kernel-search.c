@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// linear search for the first element of an int array of MAGIC_TRIP
+// elements that equals key, counting the elements below key on the way.
+// the loop has a second exit, and the count depends on a branch on random
+// data that the predictor cannot learn. the key is only at the last
+// position, so the whole array is searched
+
+int MAGIC_FUNC (const int *a, int key, int *below)
+{
+    int i, n;
+
+    n = 0;
+
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        if (a[i] == key) {
+            break;
+        }
+        if (a[i] < key) {
+            n++;
+        }
+    }
+
+    *below = n;
+    return i;
+}
+
+int main(void)
+{
+    int *a, i, key, below, n, ret;
+
+    a = harness_alloc(MAGIC_TRIP * sizeof(int));
+    harness_fill(a, MAGIC_TRIP, 1000, 1);
+
+    // values are below 1000 except for the key
+    key = 500;
+    for (i = 0; i < MAGIC_TRIP; i++) {
+        if (a[i] == key) {
+            a[i] = 1000;
+        }
+    }
+    a[MAGIC_TRIP - 1] = key;
+
+    ret = below = 0;
+    HARNESS_MEASURE(ret = MAGIC_FUNC (a, key, &below); do_not_optimize(ret));
+
+    n = 0;
+    for (i = 0; i < MAGIC_TRIP - 1; i++) {
+        n += a[i] < key;
+    }
+    harness_check(ret == MAGIC_TRIP - 1 && below == n, "search");
+
+    printf("result: %d\n", ret + below);
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// 3-point stencil over an int array of MAGIC_TRIP elements. the loads of
+// neighbouring iterations overlap, which unrolling can reuse
+
+void MAGIC_FUNC (int * restrict b, const int * restrict a)
+{
+    int i;
+
+    for (i = 1; i < MAGIC_TRIP - 1; i++) {
+        b[i] = a[i - 1] + 2 * a[i] + a[i + 1];
+    }
+}
+
+int main(void)
+{
+    int *a, *b, i;
+    long long ret;
+
+    a = harness_alloc(MAGIC_TRIP * sizeof(int));
+    b = harness_alloc(MAGIC_TRIP * sizeof(int));
+    harness_fill(a, MAGIC_TRIP, 1000, 1);
+
+    HARNESS_MEASURE(MAGIC_FUNC (b, a); do_not_optimize(b));
+
+    ret = 0;
+    for (i = 1; i < MAGIC_TRIP - 1; i++) {
+        harness_check(b[i] == a[i - 1] + 2 * a[i] + a[i + 1], "stencil");
+        ret += b[i];
+    }
+
+    printf("result: %lld\n", ret);
+
+    return 0;
+}
@@ -18,15 +18,11 @@ int MAGIC_FUNC (int a)
 
 int main(void)
 {
-    uint64_t t0, t1;
     int ret;
 
-    t0 = rdtsc();
-    ret = MAGIC_FUNC (MAGIC_TRIP);
-    t1 = rdtsc();
+    HARNESS_MEASURE(ret = MAGIC_FUNC (MAGIC_TRIP); do_not_optimize(ret));
 
     printf("result: %d\n", ret);
-    printf("time: %zu\n", t1 - t0);
 
     return 0;
 }
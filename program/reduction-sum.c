@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helper.h"
+
+// sum reduction with a trip count that is a multiple of the unroll count, so
+// that -my-unroll-split-reductions gives each copy its own accumulator. the
+// pragma unrolls it by 4 if no count is given. `make check` runs it
+
+int MAGIC_FUNC (const int *a)
+{
+    int i, x;
+
+    x = 0;
+
+#pragma clang loop unroll_count(4)
+    for (i = 0; i < MAGIC_TRIP * 4; i++) {
+        x += a[i];
+    }
+
+    return x;
+}
+
+int reference(const int *a)
+{
+    int i, x = 0;
+
+    for (i = 0; i < MAGIC_TRIP * 4; i++) {
+        x += a[i];
+    }
+
+    return x;
+}
+
+int main(void)
+{
+    int *a, ret;
+
+    a = harness_alloc(MAGIC_TRIP * 4 * sizeof(int));
+    harness_fill(a, MAGIC_TRIP * 4, 1000, 1);
+
+    ret = 0;
+    HARNESS_MEASURE(ret = MAGIC_FUNC (a); do_not_optimize(ret));
+
+    harness_check(ret == reference(a), "sum reduction");
+    printf("result: %d\n", ret);
+
+    return 0;
+}
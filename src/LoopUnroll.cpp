@@ -1,4 +1,5 @@
 #include "llvm/Transforms/Utils/UnrollLoop.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/CodeMetrics.h"
@@ -8,6 +9,7 @@
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfoMetadata.h"
@@ -15,6 +17,9 @@
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -24,10 +29,32 @@
 #include "llvm/Transforms/Utils/SimplifyIndVar.h"
 using namespace llvm;
 
+#include <mutex>
+
 #include "LoopUnroll.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "my-loop-unroll"
+
+STATISTIC(NumCompletelyUnrolled, "Number of loops completely unrolled");
+STATISTIC(NumPartiallyUnrolled, "Number of loops partially unrolled");
+STATISTIC(NumRuntimeUnrolled, "Number of loops unrolled with a run-time trip count prolog");
+STATISTIC(NumVersioned, "Number of loops unrolled behind run-time checks");
+STATISTIC(NumInstructionsAdded, "Number of instructions added by peeling and unrolling");
+STATISTIC(NumSkippedShape, "Number of loops skipped: no exiting branch in the latch");
+STATISTIC(NumSkippedCount, "Number of loops skipped: no unroll count");
+STATISTIC(NumSkippedSize, "Number of loops skipped: over the size threshold");
+STATISTIC(NumSkippedPragma, "Number of loops skipped: disabled or unknown trip count with a pragma");
+STATISTIC(NumSkippedMinSize, "Number of loops skipped: function optimized for minimum size");
+STATISTIC(NumSkippedCold, "Number of loops skipped: not hot in the profile");
+STATISTIC(NumSkippedBudget, "Number of loops skipped: nest size budget exhausted");
+STATISTIC(NumSkippedJam, "Number of loop nests not unrolled and jammed: shape or dependences");
+
+// the phases of the pass are timed with -time-passes
+static const char *TimerGroupName = "my-loop-unroll";
+static const char *TimerGroupDescription = "My loop unroll phases";
+
 
 // command line options
 
@@ -37,6 +64,48 @@ static cl::opt<unsigned> UnrollThreshold ("my-unroll-threshold", cl::init(0), cl
 static cl::opt<unsigned> UnrollCount ("my-unroll-count", cl::init(0), cl::Hidden,
                                       cl::desc("Use this unroll count for all loops, for testing purposes"));
 
+static cl::opt<bool> UnrollRuntime ("my-unroll-runtime", cl::init(true), cl::Hidden,
+                                    cl::desc("Unroll loops with run-time trip counts using a prolog loop"));
+
+static cl::opt<bool> UnrollProfile ("my-unroll-profile", cl::init(false), cl::Hidden,
+                                    cl::desc("Only unroll loops that are hot in the profile, using its average trip count"));
+
+static cl::list<std::string> UnrollFunctions ("my-unroll-func", cl::ZeroOrMore, cl::CommaSeparated, cl::Hidden,
+                                              cl::desc("Only unroll loops in functions matching these regular expressions"));
+
+static cl::opt<unsigned> UnrollAndJamCount ("my-unroll-and-jam-count", cl::init(0), cl::Hidden,
+                                            cl::desc("Unroll the outer loop of two-deep nests by this count and jam the inner loops"));
+
+static cl::opt<unsigned> UnrollNestThreshold ("my-unroll-nest-threshold", cl::init(0), cl::Hidden,
+                                              cl::desc("Size limit shared by all loops of a loop nest, zero for none"));
+
+static cl::opt<bool> UnrollSplitReductions ("my-unroll-split-reductions", cl::init(true), cl::Hidden,
+                                            cl::desc("Give each unrolled copy its own accumulator for reductions"));
+
+static cl::opt<bool> UnrollVector ("my-unroll-vector", cl::init(false), cl::Hidden,
+                                   cl::desc("Unroll simple array loops by multiples of the vector width and group their memory accesses for the SLP vectorizer"));
+
+static cl::opt<bool> UnrollVersion ("my-unroll-version", cl::init(false), cl::Hidden,
+                                    cl::desc("Unroll a copy of the loop guarded by run-time checks, keeping the original as fallback"));
+
+static cl::opt<bool> UnrollSchedule ("my-unroll-schedule", cl::init(false), cl::Hidden,
+                                     cl::desc("Interleave the instructions of the unrolled copies with a list scheduler"));
+
+static cl::opt<bool> UnrollPrefetch ("my-unroll-prefetch", cl::init(false), cl::Hidden,
+                                     cl::desc("Prefetch the strided loads of partially unrolled loops"));
+
+static cl::opt<bool> UnrollTime ("my-unroll-time", cl::init(false), cl::Hidden,
+                                 cl::desc("Report the time taken to unroll each loop, with its count and size"));
+
+static cl::opt<unsigned> PeelCount ("my-peel-count", cl::init(0), cl::Hidden,
+                                    cl::desc("Peel this many iterations off all loops before unrolling them"));
+
+static cl::opt<unsigned> PeelMaxCount ("my-peel-max-count", cl::init(2), cl::Hidden,
+                                       cl::desc("Peel up to this many iterations to make header phis invariant, zero to disable"));
+
+static cl::opt<unsigned> UnrollPragmaThreshold ("my-unroll-pragma-threshold", cl::init(16 * 1024), cl::Hidden,
+                                                cl::desc("Unrolled size limit for loops with an unroll pragma"));
+
 
 // helper functions
 
@@ -68,9 +137,140 @@ static unsigned estimateLoopSize(const Loop *L, AssumptionCache *AC,
     return size;
 }
 
+// returns the number of instructions in F
+static unsigned countInstructions(const Function &F)
+{
+    unsigned Count = 0;
+    for (const BasicBlock &BB : F) {
+        Count += BB.size();
+    }
+    return Count;
+}
+
+// reports to -pass-remarks-missed that L is not unrolled
+static void reportSkipped(OptimizationRemarkEmitter *ORE, Loop *L, StringRef Name,
+                          StringRef Message)
+{
+    ORE->emit(OptimizationRemarkMissed(DEBUG_TYPE, Name, L->getStartLoc(), L->getHeader())
+              << Message);
+}
+
+// returns true if the function name matches one of the -my-unroll-func
+// patterns, or no patterns were given
+bool isSelectedFunction(StringRef Name)
+{
+    if (UnrollFunctions.empty()) {
+        return true;
+    }
+
+    // the patterns are compiled on first use, which may be in any of the
+    // driver's threads
+    static std::vector<Regex> Patterns;
+    static std::once_flag PatternsCompiled;
+    std::call_once(PatternsCompiled, []() {
+        for (const std::string &Pattern : UnrollFunctions) {
+            Regex R("^(" + Pattern + ")$");
+            std::string Error;
+            if (!R.isValid(Error)) {
+                report_fatal_error("invalid -my-unroll-func pattern '" + Pattern + "': " + Error);
+            }
+            Patterns.push_back(std::move(R));
+        }
+    });
+
+    for (Regex &R : Patterns) {
+        if (R.match(Name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// returns the trip count of the loop if it is a constant that fits in 64 bits,
+// otherwise zero
+static uint64_t getConstantTripCount(Loop *L, BasicBlock *ExitingBlock,
+                                     ScalarEvolution *SE)
+{
+    const SCEVConstant *ExitCount =
+        dyn_cast<SCEVConstant>(SE->getExitCount(L, ExitingBlock));
+    if (!ExitCount) {
+        return 0;
+    }
+
+    // the trip count is one more than the backedge-taken count, so leave
+    // room for the increment
+    const APInt &BECount = ExitCount->getAPInt();
+    if (BECount.getActiveBits() > 63) {
+        return 0;
+    }
+
+    return BECount.getZExtValue() + 1;
+}
+
+// removes the exits of L whose branch condition is a constant or proven by
+// SCEV to stay in the loop. the exit blocks lose the folded block as
+// predecessor. returns true if an exit was removed
+static bool foldKnownExits(Loop *L, ScalarEvolution *SE)
+{
+    bool Changed = false;
+
+    for (BasicBlock *BB : L->getBlocks()) {
+        BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        if (!BI || BI->isUnconditional()) {
+            continue;
+        }
+
+        bool ExitOnTrue = !L->contains(BI->getSuccessor(0));
+        if (ExitOnTrue == !L->contains(BI->getSuccessor(1))) {
+            continue;
+        }
+        BasicBlock *Exit = BI->getSuccessor(!ExitOnTrue);
+        BasicBlock *Stay = BI->getSuccessor(ExitOnTrue);
+
+        // the value of the condition, if known
+        bool CondValue;
+        Value *Cond = BI->getCondition();
+        if (ConstantInt *CI = dyn_cast<ConstantInt>(Cond)) {
+            CondValue = CI->isOne();
+        } else if (ICmpInst *Cmp = dyn_cast<ICmpInst>(Cond)) {
+            if (!SE->isSCEVable(Cmp->getOperand(0)->getType())) {
+                continue;
+            }
+            const SCEV *LHS = SE->getSCEV(Cmp->getOperand(0));
+            const SCEV *RHS = SE->getSCEV(Cmp->getOperand(1));
+            if (SE->isKnownPredicate(Cmp->getPredicate(), LHS, RHS)) {
+                CondValue = true;
+            } else if (SE->isKnownPredicate(Cmp->getInversePredicate(), LHS, RHS)) {
+                CondValue = false;
+            } else {
+                continue;
+            }
+        } else {
+            continue;
+        }
+
+        // an exit that is always taken makes the rest of the copy dead, which
+        // is left to later passes
+        if (CondValue == ExitOnTrue) {
+            continue;
+        }
+
+        Exit->removePredecessor(BB);
+        BranchInst::Create(Stay, BI);
+        BI->eraseFromParent();
+        Changed = true;
+    }
+
+    if (Changed) {
+        DEBUG(dbgs() << "  folded known exits\n");
+    }
+    return Changed;
+}
+
 // convert the instruction operands from referencing the current values into
 // those specified by ValueMap.
-static inline void remapInstruction(Instruction *I, ValueToValueMapTy &ValueMap)
+void remapInstruction(Instruction *I, ValueToValueMapTy &ValueMap)
 {
     for (unsigned op = 0, E = I->getNumOperands(); op != E; ++op) {
         Value *Op = I->getOperand(op);
@@ -153,65 +353,109 @@ static BasicBlock *foldBlockIntoPredecessor(BasicBlock *BB, LoopInfo *LI,
     return Pred;
 }
 
-// if Count is zero, try to automatically find UnrollCount
+// if Count is zero, try to automatically find UnrollCount (see computeUnrollCount)
 // if Threshold equal zero, no threshold is enforced
+// if AllowRuntime is set, loops with an unknown trip count get a prolog loop
+// for the remainder iterations
+// if ProfileTripCount is not zero, it is the average trip count from the profile
+// the decisions are reported to ORE as optimization remarks
 // returns true if any transformations are performed
-bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
-                LoopInfo *LI, DominatorTree *DT, ScalarEvolution *SE,
-                AssumptionCache *AC, const TargetTransformInfo &TTI)
+bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold, bool AllowRuntime,
+                unsigned ProfileTripCount, LoopInfo *LI, DominatorTree *DT, ScalarEvolution *SE,
+                AssumptionCache *AC, AliasAnalysis *AA, const TargetTransformInfo &TTI,
+                OptimizationRemarkEmitter *ORE)
 {
     assert(L->isLCSSAForm(*DT));
     // TODO: L->isLoopSimplifyForm() ?
 
-    unsigned TripCount, TripMultiple, LoopSize;
+    TimeRecord StartTime = TimeRecord::getCurrentTime(true);
+
+    uint64_t TripCount;
+    unsigned TripMultiple, LoopSize;
 
     BasicBlock *Header = L->getHeader();
     BasicBlock *LatchBlock = L->getLoopLatch();
     BranchInst *BI = dyn_cast<BranchInst>(LatchBlock->getTerminator());
 
-    // loop must terminate in a condition branch
+    // loop must terminate in a branch, which either exits or, for loops
+    // only left through side exits like a break, is unconditional
     // use `loop-rotate` pass to fix this
-    if (!BI || BI->isUnconditional()) {
-        errs() << "skipping: loop not terminated by a conditional branch\n";
+    if (!BI) {
+        DEBUG(dbgs() << "skipping: loop not terminated by a branch\n");
+        reportSkipped(ORE, L, "NoLatchBranch", "loop not terminated by a branch");
+        NumSkippedShape++;
+        return false;
+    }
+    bool LatchExits = BI->isConditional();
+    if (LatchExits && !L->isLoopExiting(LatchBlock)) {
+        DEBUG(dbgs() << "skipping: loop not terminated by an exiting branch\n");
+        reportSkipped(ORE, L, "NoLatchExit", "loop not terminated by an exiting branch");
+        NumSkippedShape++;
         return false;
     }
 
-    // determine Trip and TripMultiple count
+    // determine Trip and TripMultiple count. they describe the exit in the
+    // latch, side exits may still leave the loop earlier
     TripCount = 0;              // 0 = unknown
     TripMultiple = 1;           // greatest known integer multiple of the trip count
 
-    // TODO: check for large loop counts
-    BasicBlock *ExitingBlock = L->getLoopLatch();
-    if (!ExitingBlock || !L->isLoopExiting(ExitingBlock))
-        ExitingBlock = L->getExitingBlock();
-    if (ExitingBlock) {
-        TripCount = SE->getSmallConstantTripCount(L, ExitingBlock);
-        TripMultiple = SE->getSmallConstantTripMultiple(L, ExitingBlock);
+    if (LatchExits) {
+        TripCount = getConstantTripCount(L, LatchBlock, SE);
+        TripMultiple = SE->getSmallConstantTripMultiple(L, LatchBlock);
+    }
+
+    SmallVector<BasicBlock*, 4> ExitingBlocks;
+    L->getExitingBlocks(ExitingBlocks);
+    if (ExitingBlocks.size() > 1 || !LatchExits) {
+        DEBUG(dbgs() << "  exiting blocks = " << ExitingBlocks.size() << "\n");
     }
 
     // print counts
-    errs() << "  trip count = ";
+    DEBUG(dbgs() << "  trip count = ");
     if (TripCount != 0) {
-        errs() << TripCount << "\n";
+        DEBUG(dbgs() << TripCount << "\n");
     } else {
-        errs() << "unknown" << "\n";
+        DEBUG(dbgs() << "unknown" << "\n");
     }
     if (TripMultiple != 1) {
-        errs() << "  trip multiple = " << TripMultiple << "\n";
+        DEBUG(dbgs() << "  trip multiple = " << TripMultiple << "\n");
     }
 
-    // try to automatically calculate the UnrollCount
+    // calculate loop size
+    LoopSize = estimateLoopSize(L, AC, TTI);
+    DEBUG(dbgs() << "  size = " << LoopSize << "\n");
+    ORE->emit(OptimizationRemarkAnalysis(DEBUG_TYPE, "LoopShape", L->getStartLoc(), Header)
+              << "loop size " << ore::NV("LoopSize", LoopSize)
+              << ", trip count " << ore::NV("TripCount", TripCount)
+              << ", trip multiple " << ore::NV("TripMultiple", TripMultiple));
+
+    // try to automatically calculate the UnrollCount from the target's
+    // preferences, the register pressure and the loop-carried dependences
     if (Count == 0) {
-        // if we know trip count, try to completely unroll (enforcing threshold)
-        // else, bail out
-        if (TripCount != 0) {
-            Count = TripCount;
-        } else {
-            errs() << "skipping: cannot determine unroll count\n";
+        NamedRegionTimer T("count", "Unroll count heuristic", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
+        Count = computeUnrollCount(L, TripCount, TripMultiple, ProfileTripCount,
+                                   LoopSize, Threshold, AllowRuntime, UnrollSplitReductions,
+                                   LI, SE, TTI);
+        if (Count == 0) {
+            DEBUG(dbgs() << "skipping: cannot determine unroll count\n");
+            reportSkipped(ORE, L, "NoUnrollCount", "cannot determine unroll count");
+            NumSkippedCount++;
             return false;
         }
     }
 
+    // in vector mode, unroll simple array loops by a multiple of the number
+    // of elements in a vector register, so that the copies fill whole vectors
+    bool VectorLoop = false;
+    if (UnrollVector) {
+        if (unsigned VF = getVectorUnrollFactor(L, SE, TTI)) {
+            Count = Count < VF ? VF : Count / VF * VF;
+            VectorLoop = true;
+            DEBUG(dbgs() << "  vector factor = " << VF << ", count = " << Count << "\n");
+        }
+    }
+
     // cant unroll more times than the trip count, if known
     if (TripCount != 0 && Count > TripCount) {
         Count = TripCount;
@@ -222,16 +466,25 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
     assert(TripMultiple > 0);
     assert(TripCount == 0 || TripCount % TripMultiple == 0);
 
-    // calculate loop size
-    LoopSize = estimateLoopSize(L, AC, TTI);
-    errs() << "  size = " << LoopSize << "\n";
-
-    // enforce the threshold
+    // enforce the threshold. a complete unroll is measured by what is left
+    // once the copies are simplified
     if (Threshold > 0) {
+        NamedRegionTimer T("size", "Unrolled size estimate", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
         uint64_t Size = (uint64_t) LoopSize * Count;
+        unsigned UnrolledSize;
+        if (Size > Threshold && Count == TripCount &&
+            estimateUnrolledSize(L, TripCount, Threshold, LI, TTI, UnrolledSize)) {
+            DEBUG(dbgs() << "  simplified size = " << UnrolledSize << "\n");
+            Size = UnrolledSize;
+        }
         if (Size > Threshold) {
-            errs() << "skipping: too large to unroll (threshold = "
-                   << Threshold << ")\n";
+            DEBUG(dbgs() << "skipping: too large to unroll (threshold = "
+                         << Threshold << ")\n");
+            ORE->emit(OptimizationRemarkMissed(DEBUG_TYPE, "TooLarge", L->getStartLoc(), Header)
+                      << "unrolled size " << ore::NV("UnrolledSize", Size)
+                      << " over threshold " << ore::NV("Threshold", Threshold));
+            NumSkippedSize++;
             return false;
         }
     }
@@ -239,6 +492,42 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
     // if TripCount and Count is the same, the loop will be completely unrolled
     bool CompletelyUnroll = Count == TripCount;
 
+    // if the trip count is unknown and not a known multiple of Count, run the
+    // remainder iterations in a prolog loop, so the trip count of the loop
+    // left to unroll is a multiple of Count
+    // if the profile shows the loop usually runs fewer than Count iterations,
+    // the prolog would do all the work, so keep the exit tests instead
+    bool RuntimeTripCount = false;
+    if (AllowRuntime && ProfileTripCount != 0 && ProfileTripCount < Count) {
+        DEBUG(dbgs() << "  no runtime prolog: profile trip count below unroll count\n");
+        AllowRuntime = false;
+    }
+
+    // with versioning, the unrolled loop is only entered when the run-time
+    // checks hold, including that the trip count is a multiple of Count, and
+    // the original loop runs otherwise
+    bool Versioned = false;
+    if (UnrollVersion && !CompletelyUnroll && Count > 1) {
+        NamedRegionTimer T("version", "Loop versioning", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
+        bool CheckTripMultiple = TripCount == 0 && TripMultiple % Count != 0;
+        // versionLoop resets CheckTripMultiple if its guard cannot check
+        // the trip count, which then stays unknown
+        Versioned = versionLoop(L, Count, CheckTripMultiple, LI, DT, SE);
+        if (Versioned && CheckTripMultiple) {
+            TripMultiple = Count;
+        }
+    }
+
+    if (!Versioned && TripCount == 0 && TripMultiple % Count != 0 && AllowRuntime) {
+        NamedRegionTimer T("prolog", "Run-time trip count prolog", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
+        RuntimeTripCount = unrollRuntimeLoopProlog(L, Count, LI, DT, SE);
+        if (RuntimeTripCount) {
+            TripMultiple = Count;
+        }
+    }
+
     // if we know the trip count, we know the multiple...
     unsigned BreakoutTrip = 0;
     if (TripCount != 0) {
@@ -250,29 +539,50 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
             (unsigned) GreatestCommonDivisor64(Count, TripMultiple);
     }
 
-    // check valid count
-    assert(BreakoutTrip == 0);  // TODO
-
     // print some info
     if (CompletelyUnroll) {
-        errs() << "COMPLETELY unrolling\n";
+        DEBUG(dbgs() << "COMPLETELY unrolling\n");
+        ORE->emit(OptimizationRemark(DEBUG_TYPE, "FullyUnrolled", L->getStartLoc(), Header)
+                  << "completely unrolled loop with "
+                  << ore::NV("UnrollCount", TripCount) << " iterations");
+        NumCompletelyUnrolled++;
     } else {
-        errs() << "PARTIALLY unrolling" << " by " << Count << "\n";
+        DEBUG(dbgs() << "PARTIALLY unrolling" << " by " << Count << "\n");
 
-        if (TripMultiple == 0 || BreakoutTrip != TripMultiple) {
-            errs() << "  with a breakout at trip " << BreakoutTrip << "\n";
+        if (Versioned) {
+            DEBUG(dbgs() << "  versioned, with the original loop as fallback\n");
+        }
+        ORE->emit(OptimizationRemark(DEBUG_TYPE, "PartialUnrolled", L->getStartLoc(), Header)
+                  << "unrolled loop by a factor of " << ore::NV("UnrollCount", Count)
+                  << (RuntimeTripCount ? " with a run-time trip count prolog" : "")
+                  << (Versioned ? " behind run-time checks" : ""));
+        NumPartiallyUnrolled++;
+        if (RuntimeTripCount) {
+            NumRuntimeUnrolled++;
+        }
+        if (Versioned) {
+            NumVersioned++;
+        }
+
+        if (RuntimeTripCount) {
+            DEBUG(dbgs() << "  with a run-time trip count prolog\n");
+        } else if (TripMultiple == 0 || BreakoutTrip != TripMultiple) {
+            DEBUG(dbgs() << "  with a breakout at trip " << BreakoutTrip << "\n");
         } else if (TripMultiple != 1) {
-            errs() << "  with " << TripMultiple << " trips per branch" << "\n";
+            DEBUG(dbgs() << "  with " << TripMultiple << " trips per branch" << "\n");
         }
     }
 
     std::vector<BasicBlock*> LoopBlocks = L->getBlocks();
 
-    bool ContinueOnTrue = L->contains(BI->getSuccessor(0));
-    BasicBlock *LoopExit = BI->getSuccessor(ContinueOnTrue);
+    bool ContinueOnTrue = LatchExits && L->contains(BI->getSuccessor(0));
+    BasicBlock *LoopExit = LatchExits ? BI->getSuccessor(ContinueOnTrue) : nullptr;
+
+    // the values computed by the loop and its subloops change, forget them
+    // once here rather than for every cloned subloop
+    SE->forgetLoop(L);
 
     // first iteration should use precloned values in place of phi nodes
-    // typedef DenseMap<const Value*, Value*> ValueMapTy;
     ValueToValueMapTy LastValueMap;
     std::vector<PHINode*> OrigPHINode;
     for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
@@ -287,6 +597,38 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
         }
     }
 
+    // reductions get one accumulator per copy if only the last copy exits,
+    // so that the accumulators can be combined after the loop
+    std::vector<UnrollReduction> Reductions;
+    bool OnlyLastLatchExits = TripCount != 0 ? BreakoutTrip == 0 : TripMultiple == Count;
+    if (UnrollSplitReductions && !CompletelyUnroll && Count > 1 && OnlyLastLatchExits &&
+        L->getExitingBlock() == LatchBlock && LoopExit->getSinglePredecessor() == LatchBlock) {
+        findReductions(L, OrigPHINode, Reductions);
+        if (!Reductions.empty()) {
+            DEBUG(dbgs() << "  with " << Reductions.size() << " split reductions\n");
+        }
+    }
+    std::vector<std::vector<Value*> > ReductionResults(Reductions.size());
+    for (unsigned r = 0; r != Reductions.size(); ++r) {
+        ReductionResults[r].push_back(Reductions[r].Result);
+    }
+
+    // the phis of the exit blocks with their incoming value from each exiting
+    // block, looked up once instead of in the growing phis for every clone
+    typedef SmallVector<std::pair<PHINode*, Value*>, 4> ExitPHIList;
+    DenseMap<BasicBlock*, ExitPHIList> ExitPHIs;
+    for (BasicBlock *BB : LoopBlocks) {
+        for (BasicBlock *Succ : successors(BB)) {
+            if (L->contains(Succ))
+                continue;
+
+            for (BasicBlock::iterator BBI = Succ->begin();
+                 PHINode *phi = dyn_cast<PHINode>(BBI); ++BBI) {
+                ExitPHIs[BB].push_back(std::make_pair(phi, phi->getIncomingValueForBlock(BB)));
+            }
+        }
+    }
+
     std::vector<BasicBlock*> Headers;
     std::vector<BasicBlock*> Latches;
     Headers.push_back(Header);
@@ -303,67 +645,62 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
     LoopBlocksDFS::RPOIterator BlockBegin = DFS.beginRPO();
     LoopBlocksDFS::RPOIterator BlockEnd = DFS.endRPO();
 
-    std::vector<BasicBlock*> UnrolledLoopBlocks = L->getBlocks();
-
     // unroll
+    std::unique_ptr<NamedRegionTimer> CopyTimer(
+        new NamedRegionTimer("copy", "Copying the loop body", TimerGroupName,
+                             TimerGroupDescription, TimePassesIsEnabled));
+    std::vector<Value*> HeaderInVals(OrigPHINode.size());
     for (unsigned It = 1; It != Count; ++It) {
         std::vector<BasicBlock*> NewBlocks;
         SmallDenseMap<const Loop *, Loop *, 4> NewLoops;
         NewLoops[L] = L;
 
+        // the values the header phis take in this iteration, taken before the
+        // header is cloned over the values of the previous iteration
+        for (unsigned i = 0, e = OrigPHINode.size(); i != e; ++i) {
+            Value *InVal = OrigPHINode[i]->getIncomingValueForBlock(LatchBlock);
+
+            if (Instruction *InValI = dyn_cast<Instruction>(InVal)) {
+                if (It > 1 && L->contains(InValI)) {
+                    InVal = LastValueMap[InValI];
+                }
+            }
+            HeaderInVals[i] = InVal;
+        }
+
         // for each block, for each iteration
         for (LoopBlocksDFS::RPOIterator BB = BlockBegin; BB != BlockEnd; ++BB) {
-            // clone block and insert
-            ValueToValueMapTy VMap;
-            BasicBlock *New = CloneBasicBlock(*BB, VMap, "." + Twine(It));
+            // clone block and insert. the clones are recorded straight into
+            // the running map of newest clones
+            BasicBlock *New = CloneBasicBlock(*BB, LastValueMap, "." + Twine(It));
             Header->getParent()->getBasicBlockList().push_back(New);
+            LastValueMap[*BB] = New;
 
             assert((*BB != Header || LI->getLoopFor(*BB) == L) &&
                    "Header should not be in a sub-loop");
 
-            // add info for new block and forget old since values may have changed
-            const Loop *OldLoop = addClonedBlockToLoopInfo(*BB, New, LI, NewLoops);
-            if (OldLoop && SE) {
-                SE->forgetLoop(OldLoop);
-            }
+            // add info for new block
+            addClonedBlockToLoopInfo(*BB, New, LI, NewLoops);
 
-            // loop over all of the PHI nodes in the block, changing them to use
-            // the incoming values from the previous block
+            // the header phis are replaced by the values from the previous block
             if (*BB == Header) {
-                for (PHINode *OrigPHI : OrigPHINode) {
-                    PHINode *NewPHI = cast<PHINode>(VMap[OrigPHI]);
-                    Value *InVal = NewPHI->getIncomingValueForBlock(LatchBlock);
-
-                    if (Instruction *InValI = dyn_cast<Instruction>(InVal)) {
-                        if (It > 1 && L->contains(InValI)) {
-                            InVal = LastValueMap[InValI];
-                        }
-                    }
-                    VMap[OrigPHI] = InVal;
+                for (unsigned i = 0, e = OrigPHINode.size(); i != e; ++i) {
+                    PHINode *NewPHI = cast<PHINode>(LastValueMap[OrigPHINode[i]]);
+                    LastValueMap[OrigPHINode[i]] = HeaderInVals[i];
                     New->getInstList().erase(NewPHI);
                 }
             }
 
-            // update our running map of newest clones
-            LastValueMap[*BB] = New;
-            for (ValueToValueMapTy::iterator VI = VMap.begin(), VE = VMap.end();
-                 VI != VE; ++VI) {
-                LastValueMap[VI->first] = VI->second;
-            }
-
             // add phi entries for newly created values to all exit blocks
-            for (BasicBlock *Succ : successors(*BB)) {
-                if (L->contains(Succ))
-                    continue;
-
-                for (BasicBlock::iterator BBI = Succ->begin();
-                     PHINode *phi = dyn_cast<PHINode>(BBI); ++BBI) {
-                    Value *Incoming = phi->getIncomingValueForBlock(*BB);
+            auto EI = ExitPHIs.find(*BB);
+            if (EI != ExitPHIs.end()) {
+                for (auto &Entry : EI->second) {
+                    Value *Incoming = Entry.second;
                     ValueToValueMapTy::iterator It = LastValueMap.find(Incoming);
 
                     if (It != LastValueMap.end())
                         Incoming = It->second;
-                    phi->addIncoming(Incoming, New);
+                    Entry.first->addIncoming(Incoming, New);
                 }
             }
 
@@ -375,7 +712,6 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
                 Latches.push_back(New);
 
             NewBlocks.push_back(New);
-            UnrolledLoopBlocks.push_back(New);
 
             // update DomTree: since we just copy the loop body, and each copy
             // has a dedicated entry block (copy of the header block), this
@@ -409,24 +745,21 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
                 }
             }
         }
-    } // end for Count
 
-
-    // the latch block exits the loop
-    // update phi nodes in successor to values in last unroll iteration
-    if (Count != 1) {
-        // find uses of phi
-        SmallPtrSet<PHINode*, 8> Users;
-        for (Value::use_iterator UI = LatchBlock->use_begin(),
-                 UE = LatchBlock->use_end(); UI != UE; ++UI) {
-            if (PHINode *phi = dyn_cast<PHINode>(*UI))
-                Users.insert(phi);
+        for (unsigned r = 0; r != Reductions.size(); ++r) {
+            ReductionResults[r].push_back(LastValueMap[Reductions[r].Result]);
         }
+    } // end for Count
+    CopyTimer.reset();
 
-        BasicBlock *LastIterationBB = cast<BasicBlock>(LastValueMap[LatchBlock]);
-        for (SmallPtrSet<PHINode*,8>::iterator SI = Users.begin(), SE = Users.end();
-             SI != SE; ++SI) {
-            PHINode *PN = *SI;
+    // loop over the PHI nodes in the original header, setting them to their
+    // incoming values, or to the values of the last iteration
+    BasicBlock *Preheader = L->getLoopPreheader();
+    for (PHINode *PN : OrigPHINode) {
+        if (CompletelyUnroll) {
+            PN->replaceAllUsesWith(PN->getIncomingValueForBlock(Preheader));
+            Header->getInstList().erase(PN);
+        } else if (Count > 1) {
             Value *InVal = PN->removeIncomingValue(LatchBlock, false);
 
             // if this value was defined in the loop, take the value defined by
@@ -435,22 +768,12 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
                 if (L->contains(InValI->getParent()))
                     InVal = LastValueMap[InVal];
             }
-            PN->addIncoming(InVal, LastIterationBB);
-        }
-    }
-
-    // if doing complete unrolling, loop over the PHI nodes in the original
-    // block, setting them to their incoming values
-    if (CompletelyUnroll) {
-        BasicBlock *Preheader = L->getLoopPreheader();
-        for (unsigned i = 0, e = OrigPHINode.size(); i != e; ++i) {
-            PHINode *PN = OrigPHINode[i];
-            PN->replaceAllUsesWith(PN->getIncomingValueForBlock(Preheader));
-            Header->getInstList().erase(PN);
+            PN->addIncoming(InVal, Latches.back());
         }
     }
 
     // connect unrolled blocks with branches
+    SmallPtrSet<BasicBlock*, 16> DroppedExits;
     for (unsigned i = 0, e = Latches.size(); i != e; ++i) {
         // original branch was replicated in each unrolled iteration
         BranchInst *Term = cast<BranchInst>(Latches[i]->getTerminator());
@@ -473,22 +796,17 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
             NeedConditional = false;
         }
 
-        if (NeedConditional) {
+        if (!LatchExits) {
+            // the latches do not exit, the copies simply follow each other
+            Term->setSuccessor(0, Dest);
+        } else if (NeedConditional) {
             // update the conditional branch's successor for the following
             // iteration
             Term->setSuccessor(!ContinueOnTrue, Dest);
         } else {
-            // remove phi operands at this loop exit
+            // the phi operands at this loop exit are removed below
             if (Dest != LoopExit) {
-                BasicBlock *BB = Latches[i];
-                for (BasicBlock *Succ: successors(BB)) {
-                    if (Succ == Headers[i])
-                        continue;
-                    for (BasicBlock::iterator BBI = Succ->begin();
-                         PHINode *Phi = dyn_cast<PHINode>(BBI); ++BBI) {
-                        Phi->removeIncomingValue(BB, false);
-                    }
-                }
+                DroppedExits.insert(Latches[i]);
             }
 
             // replace the conditional branch with an unconditional one
@@ -497,103 +815,411 @@ bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold,
         }
     }
 
+    // remove the phi operands of the latches that no longer exit, once per phi
+    if (!DroppedExits.empty()) {
+        for (BasicBlock::iterator BBI = LoopExit->begin();
+             PHINode *Phi = dyn_cast<PHINode>(BBI); ++BBI) {
+            for (unsigned i = Phi->getNumIncomingValues(); i-- != 0; ) {
+                if (DroppedExits.count(Phi->getIncomingBlock(i))) {
+                    Phi->removeIncomingValue(i, false);
+                }
+            }
+        }
+    }
+
+    for (unsigned r = 0; r != Reductions.size(); ++r) {
+        splitReduction(Reductions[r], ReductionResults[r], Latches.back(), LoopExit);
+    }
+
+    // the blocks dominated by an exiting block before unrolling are now also
+    // reached from its copies. their new dominator is the nearest common
+    // dominator of all copies, which for the latch is the first latch that
+    // still exits, or the last one
+    if (DT && Count > 1) {
+        for (BasicBlock *BB : LoopBlocks) {
+            SmallVector<BasicBlock*, 4> ChildrenToUpdate;
+            for (DomTreeNode *Child : DT->getNode(BB)->getChildren()) {
+                if (!L->contains(Child->getBlock()))
+                    ChildrenToUpdate.push_back(Child->getBlock());
+            }
+            if (ChildrenToUpdate.empty())
+                continue;
+
+            BasicBlock *NewIDom;
+            if (BB == LatchBlock) {
+                NewIDom = Latches.back();
+                for (BasicBlock *IterLatch : Latches) {
+                    BranchInst *Term = cast<BranchInst>(IterLatch->getTerminator());
+                    if (Term->isConditional()) {
+                        NewIDom = IterLatch;
+                        break;
+                    }
+                }
+            } else {
+                NewIDom = DT->findNearestCommonDominator(BB, LatchBlock);
+            }
+
+            for (BasicBlock *Child : ChildrenToUpdate)
+                DT->changeImmediateDominator(Child, NewIDom);
+        }
+    }
+
     // try to merge adjacent blocks
     SmallPtrSet<Loop *, 4> ForgottenLoops;
-    for (BasicBlock *Latch : Latches) {
-        BranchInst *Term = cast<BranchInst>(Latch->getTerminator());
+    DenseMap<BasicBlock*, unsigned> LatchIndex;
+    for (unsigned i = 0, e = Latches.size(); i != e; ++i) {
+        LatchIndex[Latches[i]] = i;
+    }
+    for (unsigned i = 0, e = Latches.size(); i != e; ++i) {
+        BranchInst *Term = cast<BranchInst>(Latches[i]->getTerminator());
         if (Term->isUnconditional()) {
             BasicBlock *Dest = Term->getSuccessor(0);
 
             if (BasicBlock *Fold =
                 foldBlockIntoPredecessor(Dest, LI, SE, ForgottenLoops, DT)) {
                 // dest has been folded into Fold. update our worklists accordingly
-                std::replace(Latches.begin(), Latches.end(), Dest, Fold);
-                UnrolledLoopBlocks.erase(std::remove(UnrolledLoopBlocks.begin(),
-                                                     UnrolledLoopBlocks.end(), Dest),
-                                         UnrolledLoopBlocks.end());
+                auto Idx = LatchIndex.find(Dest);
+                if (Idx != LatchIndex.end()) {
+                    unsigned j = Idx->second;
+                    LatchIndex.erase(Idx);
+                    Latches[j] = Fold;
+                    LatchIndex[Fold] = j;
+                }
             }
         }
     }
 
-    // errs() << "\ncode cleanup:\n";
-
     // code cleanup
-    const DataLayout &DL = Header->getModule()->getDataLayout();
-    const std::vector<BasicBlock*> &NewLoopBlocks = L->getBlocks();
-
-    for (BasicBlock *BB : NewLoopBlocks) {
-        // BB->dump();
+    {
+        NamedRegionTimer T("cleanup", "Cleanup of the unrolled loop", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
+        cleanupUnrolledLoop(L, LI, DT, SE, AC, AA);
+    }
 
-        for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ) {
-            Instruction *Inst = &*I++;
+    // the copies keep all their exits. those whose condition is now constant
+    // or known from SCEV are never taken, and are removed
+    if (foldKnownExits(L, SE)) {
+        SE->forgetLoop(L);
+        if (DT) {
+            DT->recalculate(*Header->getParent());
+        }
+    }
 
-            // constant folding
-            if (Value *V = SimplifyInstruction(Inst, DL, nullptr, DT, AC)) {
-                if (LI->replacementPreservesLCSSAForm(Inst, V)) {
-                    // errs() << "replacing\n";
-                    // Inst->dump();
-                    // errs() << "with\n  ";
-                    // V->dump();
+    // line up the accesses of the copies for the SLP vectorizer
+    if (VectorLoop) {
+        for (BasicBlock *BB : L->getBlocks()) {
+            groupMemoryAccesses(BB, SE);
+        }
+    }
 
-                    Inst->replaceAllUsesWith(V);
-                }
+    // interleave the copies, unless they were lined up for the SLP vectorizer
+    if (UnrollSchedule && !VectorLoop) {
+        NamedRegionTimer T("schedule", "Scheduling of the unrolled blocks", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
+        for (BasicBlock *BB : L->getBlocks()) {
+            if (LI->getLoopFor(BB) == L) {
+                scheduleUnrolledBlock(BB, AA, TTI);
             }
-            // remove dead instructions
-            if (isInstructionTriviallyDead(Inst)) {
-                // errs() << "removing dead inst:\n";
-                // Inst->dump();
+        }
+    }
 
-                BB->getInstList().erase(Inst);
-            }
+    // issue the loads of the next iterations early, once per cache line
+    if (UnrollPrefetch && !CompletelyUnroll && L->getNumBackEdges() != 0) {
+        NamedRegionTimer T("prefetch", "Prefetch insertion", TimerGroupName,
+                           TimerGroupDescription, TimePassesIsEnabled);
+        if (unsigned Prefetches = insertPrefetches(L, LI, SE, TTI)) {
+            DEBUG(dbgs() << "  inserted " << Prefetches << " prefetches\n");
         }
+    }
 
-        // errs() << "after:\n";
-        // BB->dump();
-        // errs() << "\n";
+    if (UnrollTime) {
+        double Elapsed = TimeRecord::getCurrentTime(false).getWallTime() -
+            StartTime.getWallTime();
+        errs() << "  time: count = " << Count << ", size = " << LoopSize
+               << ", us = " << (uint64_t) (Elapsed * 1e6) << "\n";
     }
 
     return true;
 }
 
 
-// class functions
-
-char LoopUnroll::ID = 0;
-
-bool LoopUnroll::runOnLoop(Loop *L, LPPassManager &LPM)
+// the unroll decisions for one loop, shared by both pass managers. BFI and
+// PSI may be null if they are not available. Removed is set if the loop was
+// completely unrolled and is gone from LI
+static bool tryToUnrollLoop(Loop *L, unsigned ProvidedCount, DominatorTree &DT, LoopInfo *LI,
+                            ScalarEvolution *SE, const TargetTransformInfo &TTI,
+                            AssumptionCache &AC, AliasAnalysis *AA, DependenceInfo *DI,
+                            BlockFrequencyInfo *BFI, ProfileSummaryInfo *PSI,
+                            OptimizationRemarkEmitter *ORE, bool &Removed)
 {
     BasicBlock *H = L->getHeader();
-    // Function &F = *L->getHeader()->getParent();
     Function *F = H->getParent();
     StringRef funcName = F->getName();
 
-    // check if magic function
-    if (funcName != MAGIC_FUNC) {
+    // check if selected function
+    if (!isSelectedFunction(funcName)) {
+        return false;
+    }
+
+    DEBUG(dbgs() << "Loop Unroll: F[" << funcName
+                 << "] L%" << H->getName() << "\n");
+
+    // with unroll-and-jam, two-deep nests that can be jammed are transformed
+    // as a whole when the outer loop is visited, so their inner loop is kept
+    // as it is. all other loops are unrolled as usual
+    if (UnrollAndJamCount > 0) {
+        Loop *Parent = L->getParentLoop();
+        if (L->empty() && Parent && Parent->getSubLoops().size() == 1 &&
+            !getUnrollMetadata(Parent, "llvm.loop.unroll.disable") &&
+            canUnrollAndJamLoop(Parent, UnrollAndJamCount, &DT, SE, DI)) {
+            DEBUG(dbgs() << "skipping: inner loop of an unroll-and-jam nest\n");
+            return false;
+        }
+        if (!L->empty() && !getUnrollMetadata(L, "llvm.loop.unroll.disable")) {
+            if (unrollAndJamLoop(L, UnrollAndJamCount, LI, &DT, SE, DI, &AC)) {
+                setLoopAlreadyUnrolled(L);
+                DEBUG(dbgs() << "finished\n");
+                return true;
+            }
+
+            DEBUG(dbgs() << "  cannot unroll-and-jam, unrolling as usual\n");
+            reportSkipped(ORE, L, "UnrollAndJam", "cannot unroll and jam loop nest");
+            NumSkippedJam++;
+        }
+    }
+
+    // loop pragmas take precedence over the defaults, but not over an
+    // explicit -my-unroll-count or the count the pass was created with
+    unsigned Count = ProvidedCount > 0 ? ProvidedCount : UnrollCount;
+    unsigned Threshold = UnrollThreshold;
+    bool AllowRuntime = UnrollRuntime;
+    bool Pragma = false;
+
+    if (getUnrollMetadata(L, "llvm.loop.unroll.disable")) {
+        DEBUG(dbgs() << "skipping: unrolling disabled by pragma\n");
+        reportSkipped(ORE, L, "Disabled", "unrolling disabled by pragma");
+        NumSkippedPragma++;
+        return false;
+    }
+    if (getUnrollMetadata(L, "llvm.loop.unroll.runtime.disable")) {
+        AllowRuntime = false;
+    }
+    if (Count == 0) {
+        if (unsigned PragmaCount = getUnrollPragmaCount(L)) {
+            DEBUG(dbgs() << "  pragma count = " << PragmaCount << "\n");
+            Count = PragmaCount;
+            Threshold = UnrollPragmaThreshold;
+            Pragma = true;
+        } else if (getUnrollMetadata(L, "llvm.loop.unroll.full")) {
+            unsigned TripCount = SE->getSmallConstantTripCount(L);
+            if (TripCount == 0) {
+                DEBUG(dbgs() << "skipping: full unroll pragma, but unknown trip count\n");
+                reportSkipped(ORE, L, "FullUnrollUnknownTripCount",
+                              "full unroll pragma, but unknown trip count");
+                NumSkippedPragma++;
+                return false;
+            }
+            DEBUG(dbgs() << "  pragma full\n");
+            Count = TripCount;
+            Threshold = UnrollPragmaThreshold;
+            Pragma = true;
+        } else if (getUnrollMetadata(L, "llvm.loop.unroll.enable")) {
+            DEBUG(dbgs() << "  pragma enable\n");
+            Threshold = UnrollPragmaThreshold;
+            Pragma = true;
+        }
+    }
+
+    // a count found by measurement (see utils/autotune.sh) replaces the
+    // heuristic, but not a pragma or an explicit count
+    if (Count == 0 && !Pragma) {
+        if (unsigned TunedCount = getTunedUnrollCount(L)) {
+            DEBUG(dbgs() << "  tuned count = " << TunedCount << "\n");
+            Count = TunedCount;
+        }
+    }
+
+    // functions optimized for size are only unrolled when asked for. with
+    // optsize the count is left to the size thresholds, but no prolog is added
+    if (F->optForMinSize() && Count == 0 && !Pragma) {
+        DEBUG(dbgs() << "skipping: function optimized for minimum size\n");
+        reportSkipped(ORE, L, "MinSize", "function optimized for minimum size");
+        NumSkippedMinSize++;
         return false;
     }
+    if (F->optForSize() && !Pragma) {
+        AllowRuntime = false;
+    }
+
+    // with a profile, leave cold loops alone to save code size, unless the
+    // source asks for unrolling
+    unsigned ProfileTripCount = 0;
+    if (UnrollProfile && !Pragma) {
+        bool Hot;
+        if (!BFI || !PSI || !getLoopHotness(L, BFI, PSI, Hot)) {
+            DEBUG(dbgs() << "  no profile data\n");
+        } else if (!Hot) {
+            DEBUG(dbgs() << "skipping: loop is not hot\n");
+            reportSkipped(ORE, L, "Cold", "loop is not hot");
+            NumSkippedCold++;
+            return false;
+        } else {
+            ProfileTripCount = getProfileTripCount(L);
+            if (ProfileTripCount != 0) {
+                DEBUG(dbgs() << "  profile trip count = " << ProfileTripCount << "\n");
+            }
+        }
+    }
 
-    errs() << "Loop Unroll: F[" << funcName
-           << "] L%" << H->getName() << "\n";
+    // all loops of a nest share one size budget. loops are visited inside
+    // out, so inner loops unrolled before are part of the size of the nest,
+    // and this loop may grow by what the rest of the nest leaves over
+    if (UnrollNestThreshold > 0 && !Pragma) {
+        Loop *Outermost = L;
+        while (Outermost->getParentLoop()) {
+            Outermost = Outermost->getParentLoop();
+        }
+
+        unsigned NestSize = estimateLoopSize(Outermost, &AC, TTI);
+        unsigned LoopSize = estimateLoopSize(L, &AC, TTI);
+        unsigned Rest = NestSize > LoopSize ? NestSize - LoopSize : 0;
+        if (Rest >= UnrollNestThreshold) {
+            DEBUG(dbgs() << "skipping: nest size budget exhausted (nest size = "
+                         << NestSize << ")\n");
+            ORE->emit(OptimizationRemarkMissed(DEBUG_TYPE, "NestBudget", L->getStartLoc(), H)
+                      << "nest size budget exhausted, nest size "
+                      << ore::NV("NestSize", NestSize));
+            NumSkippedBudget++;
+            return false;
+        }
+
+        unsigned Budget = UnrollNestThreshold - Rest;
+        DEBUG(dbgs() << "  nest size = " << NestSize << ", budget = " << Budget << "\n");
+        Threshold = Threshold > 0 ? std::min<unsigned>(Threshold, Budget) : Budget;
+    }
+
+    // the instructions added are only counted with -stats
+    unsigned SizeBefore = AreStatisticsEnabled() ? countInstructions(*F) : 0;
+
+    // peel the first iterations that differ from the rest, so the loop that
+    // is left starts with invariant values
+    bool Peeled = false;
+    if (!Pragma && (PeelCount > 0 || !F->optForSize())) {
+        unsigned Peel = PeelCount > 0 ? PeelCount : computePeelCount(L, PeelMaxCount);
+        unsigned TripCount = SE->getSmallConstantTripCount(L);
+        if (TripCount != 0 && Peel >= TripCount) {
+            Peel = TripCount - 1;
+        }
+
+        unsigned LoopSize = estimateLoopSize(L, &AC, TTI);
+        if (Peel > 0 && Threshold > 0 && Peel * LoopSize > Threshold) {
+            DEBUG(dbgs() << "  no peeling: peeled size " << Peel * LoopSize
+                         << " over threshold\n");
+        } else if (Peel > 0) {
+            NamedRegionTimer T("peel", "Loop peeling", TimerGroupName,
+                               TimerGroupDescription, TimePassesIsEnabled);
+            Peeled = peelLoop(L, Peel, LI, &DT, SE, &AC);
+            if (Peeled) {
+                ORE->emit(OptimizationRemark(DEBUG_TYPE, "Peeled", L->getStartLoc(), H)
+                          << "peeled " << ore::NV("PeelCount", Peel) << " iterations");
+            }
+        }
+    }
+
+    // try to unroll
+    bool Unrolled = unrollLoop(L, Count, Threshold, AllowRuntime,
+                               ProfileTripCount, LI, &DT, SE, &AC, AA, TTI, ORE);
+    if (AreStatisticsEnabled() && (Unrolled || Peeled)) {
+        unsigned SizeAfter = countInstructions(*F);
+        if (SizeAfter > SizeBefore) {
+            NumInstructionsAdded += SizeAfter - SizeBefore;
+        }
+    }
+    if (!Unrolled) {
+        if (Peeled) {
+            DEBUG(dbgs() << "finished\n");
+        }
+        return Peeled;
+    }
+
+    if (L->getNumBackEdges() != 0) {
+        // keep later passes from unrolling what is left of the loop again
+        setLoopAlreadyUnrolled(L);
+    } else {
+        // the loop is gone: its blocks and subloops move to the parent loop,
+        // which is then visited with an up to date structure. the loop pass
+        // managers skip the invalidated loop
+        SE->forgetLoop(L);
+        LI->markAsRemoved(L);
+        Removed = true;
+    }
+
+    DEBUG(dbgs() << "finished\n");
+
+    return true;
+}
+
+
+// class functions
+
+char LoopUnroll::ID = 0;
+
+bool LoopUnroll::runOnLoop(Loop *L, LPPassManager &LPM)
+{
+    Function *F = L->getHeader()->getParent();
 
     auto &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
     LoopInfo *LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
     ScalarEvolution *SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
     const TargetTransformInfo &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(*F);
     auto &AC = getAnalysis<AssumptionCacheTracker>().getAssumptionCache(*F);
+    AliasAnalysis *AA = &getAnalysis<AAResultsWrapperPass>().getAAResults();
+    DependenceInfo *DI = &getAnalysis<DependenceAnalysisWrapperPass>().getDI();
+    BlockFrequencyInfo *BFI = &getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI();
+    ProfileSummaryInfo *PSI = getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+    OptimizationRemarkEmitter *ORE = &getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+
+    // LoopInfo tells the legacy loop pass manager about removed loops
+    bool Removed = false;
+    return tryToUnrollLoop(L, ProvidedCount, DT, LI, SE, TTI, AC, AA, DI, BFI, PSI, ORE, Removed);
+}
 
-    // try to unroll
-    if (!unrollLoop(L, UnrollCount, UnrollThreshold, LI, &DT, SE, &AC, TTI)) {
-        return false;
+// the same as LoopUnroll::runOnLoop. the analyses of the loop pipeline come
+// with AR, the others are used if an earlier pass left them in the cache:
+// loop passes must not compute function analyses
+PreservedAnalyses NewLoopUnroll::run(Loop &L, LoopAnalysisManager &AM,
+                                     LoopStandardAnalysisResults &AR, LPMUpdater &U)
+{
+    Function *F = L.getHeader()->getParent();
+    const auto &FAM = AM.getResult<FunctionAnalysisManagerLoopProxy>(L, AR).getManager();
+
+    BlockFrequencyInfo *BFI = FAM.getCachedResult<BlockFrequencyAnalysis>(*F);
+    ProfileSummaryInfo *PSI = nullptr;
+    if (auto *MAMProxy = FAM.getCachedResult<ModuleAnalysisManagerFunctionProxy>(*F)) {
+        PSI = MAMProxy->getCachedResult<ProfileSummaryAnalysis>(*F->getParent());
     }
 
-    // TODO: update the loop info
-    // // If we completely unrolled the loop, remove it from the parent.
-    // if (L->getNumBackEdges() == 0)
-    //     LPM.deleteLoopFromQueue(L);
-    // LI->markAsRemoved(L);
-    // LPM.markLoopAsDeleted(L);
+    // dependences are computed on demand, so a fresh DependenceInfo is cheap
+    DependenceInfo LocalDI(F, &AR.AA, &AR.SE, &AR.LI);
+    DependenceInfo *DI = FAM.getCachedResult<DependenceAnalysis>(*F);
+    if (!DI) {
+        DI = &LocalDI;
+    }
 
-    errs() << "finished\n";
+    OptimizationRemarkEmitter LocalORE(F, BFI);
+    OptimizationRemarkEmitter *ORE = FAM.getCachedResult<OptimizationRemarkEmitterAnalysis>(*F);
+    if (!ORE) {
+        ORE = &LocalORE;
+    }
 
-    return true;
+    bool Removed = false;
+    if (!tryToUnrollLoop(&L, ProvidedCount, AR.DT, &AR.LI, &AR.SE, AR.TTI, AR.AC, &AR.AA,
+                         DI, BFI, PSI, ORE, Removed)) {
+        return PreservedAnalyses::all();
+    }
+
+    if (Removed) {
+        U.markLoopAsDeleted(L);
+    }
+    return getLoopPassPreservedAnalyses();
 }
@@ -2,9 +2,20 @@
 #define LOOP_UNROLL_H
 
 #include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
 #include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 
 using namespace llvm;
 
@@ -12,16 +23,144 @@ class LoopUnroll : public LoopPass
 {
  public:
     static char ID;
- LoopUnroll() : LoopPass(ID) {}
+ LoopUnroll(unsigned Count = 0) : LoopPass(ID), ProvidedCount(Count) {}
 
     bool runOnLoop(Loop *L, LPPassManager &LPM);
 
     void getAnalysisUsage(AnalysisUsage &AU) const override
     {
         AU.addRequired<AssumptionCacheTracker>();
+        AU.addRequired<BlockFrequencyInfoWrapperPass>();
+        AU.addRequired<DependenceAnalysisWrapperPass>();
+        AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+        AU.addRequired<ProfileSummaryInfoWrapperPass>();
         AU.addRequired<TargetTransformInfoWrapperPass>();
         getLoopAnalysisUsage(AU);
     }
+
+ private:
+    // the unroll count of this instance, used instead of -my-unroll-count
+    // if not zero
+    unsigned ProvidedCount;
+};
+
+// LoopUnroll for the new pass manager. LLVM 4.0 cannot load new pass manager
+// passes from a plugin, so opt and clang cannot run it. the driver runs it
+// with -new-pm, see driver.cpp
+class NewLoopUnroll : public PassInfoMixin<NewLoopUnroll>
+{
+ public:
+ NewLoopUnroll(unsigned Count = 0) : ProvidedCount(Count) {}
+
+    PreservedAnalyses run(Loop &L, LoopAnalysisManager &AM,
+                          LoopStandardAnalysisResults &AR, LPMUpdater &U);
+
+ private:
+    unsigned ProvidedCount;
+};
+
+// clones functions for the constant arguments their loop trip counts depend
+// on, redirects the calls and unrolls the loops of the clones
+class LoopUnrollSpecialize : public ModulePass
+{
+ public:
+    static char ID;
+ LoopUnrollSpecialize() : ModulePass(ID) {}
+
+    bool runOnModule(Module &M) override;
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override
+    {
+        AU.addRequired<AssumptionCacheTracker>();
+        AU.addRequired<BlockFrequencyInfoWrapperPass>();
+        AU.addRequired<TargetLibraryInfoWrapperPass>();
+        AU.addRequired<TargetTransformInfoWrapperPass>();
+    }
 };
 
+
+// a reduction accumulated in a header phi, see findReductions
+struct UnrollReduction
+{
+    PHINode *Phi;           // the accumulator
+    Instruction *Result;    // its value at the end of an iteration
+    bool MinMax;            // Result is a select of a compare, else a binary op
+    bool Swapped;           // the select picks the second compared value if true
+};
+
+
+// helper functions shared between the unroll transformations
+
+void remapInstruction(Instruction *I, ValueToValueMapTy &ValueMap);
+
+bool isSelectedFunction(StringRef Name);
+
+bool unrollLoop(Loop *L, unsigned Count, unsigned Threshold, bool AllowRuntime,
+                unsigned ProfileTripCount, LoopInfo *LI, DominatorTree *DT, ScalarEvolution *SE,
+                AssumptionCache *AC, AliasAnalysis *AA, const TargetTransformInfo &TTI,
+                OptimizationRemarkEmitter *ORE);
+
+unsigned computeUnrollCount(Loop *L, uint64_t TripCount, unsigned TripMultiple,
+                            unsigned ProfileTripCount, unsigned LoopSize,
+                            unsigned Threshold, bool AllowRuntime, bool SplitReductions,
+                            LoopInfo *LI, ScalarEvolution *SE, const TargetTransformInfo &TTI);
+
+unsigned computeFrontEndLimit(Loop *L, const TargetTransformInfo &TTI);
+
+bool estimateUnrolledSize(Loop *L, unsigned TripCount, unsigned Threshold,
+                          LoopInfo *LI, const TargetTransformInfo &TTI,
+                          unsigned &UnrolledSize);
+
+bool getLoopHotness(Loop *L, BlockFrequencyInfo *BFI, ProfileSummaryInfo *PSI,
+                    bool &Hot);
+
+unsigned getProfileTripCount(Loop *L);
+
+std::string getLoopFingerprint(Loop *L);
+
+unsigned getTunedUnrollCount(Loop *L);
+
+MDNode *getUnrollMetadata(Loop *L, StringRef Name);
+
+unsigned getUnrollPragmaCount(Loop *L);
+
+void setLoopAlreadyUnrolled(Loop *L);
+
+bool unrollRuntimeLoopProlog(Loop *L, unsigned Count, LoopInfo *LI,
+                             DominatorTree *DT, ScalarEvolution *SE);
+
+unsigned computePeelCount(Loop *L, unsigned MaxCount);
+
+bool peelLoop(Loop *L, unsigned PeelCount, LoopInfo *LI, DominatorTree *DT,
+              ScalarEvolution *SE, AssumptionCache *AC);
+
+void cleanupUnrolledLoop(Loop *L, LoopInfo *LI, DominatorTree *DT,
+                         ScalarEvolution *SE, AssumptionCache *AC, AliasAnalysis *AA);
+
+unsigned insertPrefetches(Loop *L, LoopInfo *LI, ScalarEvolution *SE,
+                          const TargetTransformInfo &TTI);
+
+bool versionLoop(Loop *L, unsigned Count, bool &CheckTripMultiple, LoopInfo *LI,
+                 DominatorTree *DT, ScalarEvolution *SE);
+
+bool scheduleUnrolledBlock(BasicBlock *BB, AliasAnalysis *AA,
+                           const TargetTransformInfo &TTI);
+
+void findReductions(Loop *L, ArrayRef<PHINode*> HeaderPHIs,
+                    std::vector<UnrollReduction> &Reductions);
+
+void splitReduction(const UnrollReduction &R, ArrayRef<Value*> Results,
+                    BasicBlock *Latch, BasicBlock *LoopExit);
+
+unsigned getVectorUnrollFactor(Loop *L, ScalarEvolution *SE,
+                               const TargetTransformInfo &TTI);
+
+void groupMemoryAccesses(BasicBlock *BB, ScalarEvolution *SE);
+
+bool canUnrollAndJamLoop(Loop *L, unsigned Count, DominatorTree *DT,
+                         ScalarEvolution *SE, DependenceInfo *DI);
+
+bool unrollAndJamLoop(Loop *L, unsigned Count, LoopInfo *LI, DominatorTree *DT,
+                      ScalarEvolution *SE, DependenceInfo *DI, AssumptionCache *AC);
+
 #endif /* LOOP_UNROLL_H */
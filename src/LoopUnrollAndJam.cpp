@@ -0,0 +1,584 @@
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// an outer loop recurrence that only accumulates the result of the inner
+// loop, like x in
+//
+//   for (i ...) { for (j ...) { x += j; } }
+//
+// OuterPHI -> InnerPHI -> Op -> ExitPHI -> OuterPHI. each jammed copy of the
+// inner loop gets its own accumulator, and the copies are combined after it
+struct JamReduction {
+    PHINode *OuterPHI;
+    PHINode *InnerPHI;
+    Instruction *Op;
+    PHINode *ExitPHI;
+};
+
+
+// helper functions
+
+// splits the blocks of L outside the inner loop into the ones executed before
+// it (Fore) and after it (Aft). returns false if there are blocks that are
+// neither, e.g. conditionally executed around the inner loop
+static bool partitionBlocks(Loop *L, Loop *SubL, DominatorTree *DT,
+                            SmallPtrSetImpl<BasicBlock *> &Fore,
+                            SmallPtrSetImpl<BasicBlock *> &Aft)
+{
+    BasicBlock *SubHeader = SubL->getHeader();
+    BasicBlock *SubExit = SubL->getExitBlock();
+
+    for (BasicBlock *BB : L->blocks()) {
+        if (SubL->contains(BB)) {
+            continue;
+        }
+        if (DT->dominates(BB, SubHeader)) {
+            Fore.insert(BB);
+        } else if (DT->dominates(SubExit, BB)) {
+            Aft.insert(BB);
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// collects the instructions computing V that have to move from the aft blocks
+// to the end of the fore blocks, in an order where operands come first.
+// returns false if one of them cannot be moved
+static bool collectMovable(Value *V, SmallPtrSetImpl<BasicBlock *> &Aft,
+                           SmallSetVector<Instruction *, 8> &ToMove)
+{
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !Aft.count(I->getParent()) || ToMove.count(I)) {
+        return true;
+    }
+    if (isa<PHINode>(I) || I->mayHaveSideEffects() || I->mayReadFromMemory()) {
+        return false;
+    }
+
+    for (Value *Op : I->operands()) {
+        if (!collectMovable(Op, Aft, ToMove)) {
+            return false;
+        }
+    }
+
+    ToMove.insert(I);
+    return true;
+}
+
+// returns true if the outer header phi P is a reduction over the inner loop
+static bool findReduction(PHINode *P, Loop *L, Loop *SubL, JamReduction &Red)
+{
+    PHINode *ExitPHI = dyn_cast<PHINode>(P->getIncomingValueForBlock(L->getLoopLatch()));
+    if (!ExitPHI || ExitPHI->getParent() != SubL->getExitBlock() ||
+        ExitPHI->getNumIncomingValues() != 1) {
+        return false;
+    }
+
+    Instruction *Op = dyn_cast<Instruction>(ExitPHI->getIncomingValue(0));
+    if (!Op || !SubL->contains(Op->getParent()) ||
+        !Op->isAssociative() || !Op->isCommutative() || !Op->hasNUses(2) ||
+        !ConstantExpr::getBinOpIdentity(Op->getOpcode(), Op->getType())) {
+        return false;
+    }
+
+    // the accumulator of the inner loop starts at P and is only used by Op
+    for (Value *V : Op->operands()) {
+        PHINode *InnerPHI = dyn_cast<PHINode>(V);
+        if (!InnerPHI || InnerPHI->getParent() != SubL->getHeader()) {
+            continue;
+        }
+        if (InnerPHI->getIncomingValueForBlock(SubL->getLoopPreheader()) != P ||
+            InnerPHI->getIncomingValueForBlock(SubL->getLoopLatch()) != Op ||
+            !InnerPHI->hasOneUse() || !P->hasOneUse()) {
+            return false;
+        }
+
+        Red.OuterPHI = P;
+        Red.InnerPHI = InnerPHI;
+        Red.Op = Op;
+        Red.ExitPHI = ExitPHI;
+        return true;
+    }
+
+    return false;
+}
+
+// returns true if the dependence between Src and Dst survives the reordering.
+// instructions from different parts of the body (Jammed is false) only keep
+// their order within the same outer iteration; instructions of the inner loop
+// (Jammed is true) are interleaved across outer iterations, which is only
+// wrong if an earlier outer iteration depends on a later inner iteration
+static bool isSafeDependence(Instruction *Src, Instruction *Dst, unsigned OuterLevel,
+                             bool Jammed, DependenceInfo *DI)
+{
+    if (!Src->mayWriteToMemory() && !Dst->mayWriteToMemory()) {
+        return true;
+    }
+
+    std::unique_ptr<Dependence> D = DI->depends(Src, Dst, true);
+    if (!D) {
+        return true;
+    }
+
+    unsigned Levels = OuterLevel + (Jammed ? 1 : 0);
+    if (D->isConfused() || D->getLevels() < Levels) {
+        return false;
+    }
+
+    unsigned OuterDir = D->getDirection(OuterLevel);
+    if (!Jammed) {
+        return OuterDir == Dependence::DVEntry::EQ;
+    }
+
+    unsigned InnerDir = D->getDirection(OuterLevel + 1);
+    if ((OuterDir & Dependence::DVEntry::LT) && (InnerDir & Dependence::DVEntry::GT)) {
+        return false;
+    }
+    if ((OuterDir & Dependence::DVEntry::GT) && (InnerDir & Dependence::DVEntry::LT)) {
+        return false;
+    }
+
+    return true;
+}
+
+static bool isSafeDependences(ArrayRef<Instruction *> A, ArrayRef<Instruction *> B,
+                              unsigned OuterLevel, bool Jammed, DependenceInfo *DI)
+{
+    for (Instruction *Src : A) {
+        for (Instruction *Dst : B) {
+            if (!isSafeDependence(Src, Dst, OuterLevel, Jammed, DI) ||
+                !isSafeDependence(Dst, Src, OuterLevel, Jammed, DI)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// returns true if the memory accesses of the nest allow unroll-and-jam
+static bool checkDependences(Loop *L, Loop *SubL, SmallPtrSetImpl<BasicBlock *> &Fore,
+                             DependenceInfo *DI)
+{
+    SmallVector<Instruction *, 8> ForeMem, SubMem, AftMem;
+
+    for (BasicBlock *BB : L->blocks()) {
+        for (Instruction &I : *BB) {
+            if (!I.mayReadOrWriteMemory()) {
+                continue;
+            }
+
+            // only simple loads and stores can be reasoned about
+            if (LoadInst *Ld = dyn_cast<LoadInst>(&I)) {
+                if (!Ld->isSimple()) {
+                    return false;
+                }
+            } else if (StoreInst *St = dyn_cast<StoreInst>(&I)) {
+                if (!St->isSimple()) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+
+            if (SubL->contains(BB)) {
+                SubMem.push_back(&I);
+            } else if (Fore.count(BB)) {
+                ForeMem.push_back(&I);
+            } else {
+                AftMem.push_back(&I);
+            }
+        }
+    }
+
+    unsigned OuterLevel = L->getLoopDepth();
+    return isSafeDependences(ForeMem, SubMem, OuterLevel, false, DI) &&
+        isSafeDependences(ForeMem, AftMem, OuterLevel, false, DI) &&
+        isSafeDependences(SubMem, AftMem, OuterLevel, false, DI) &&
+        isSafeDependences(SubMem, SubMem, OuterLevel, true, DI);
+}
+
+
+// what unroll-and-jam of a nest has to do besides copying: the outer
+// recurrences to compute before the inner loop, and the reductions over it
+struct JamPlan {
+    SmallSetVector<Instruction *, 8> ToMove;
+    std::vector<JamReduction> Reductions;
+};
+
+// checks that the nest of L can be unrolled by Count and jammed, see
+// unrollAndJamLoop, and plans the transformation
+static bool planUnrollAndJam(Loop *L, unsigned Count, DominatorTree *DT,
+                             ScalarEvolution *SE, DependenceInfo *DI, JamPlan &Plan)
+{
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *LatchBlock = L->getLoopLatch();
+    if (!L->getLoopPreheader() || !LatchBlock || L->getExitingBlock() != LatchBlock) {
+        DEBUG(dbgs() << "  no unroll-and-jam: outer loop not in simplified form\n");
+        return false;
+    }
+
+    BranchInst *BI = dyn_cast<BranchInst>(LatchBlock->getTerminator());
+    if (!BI || BI->isUnconditional()) {
+        DEBUG(dbgs() << "  no unroll-and-jam: loop not terminated by a conditional branch\n");
+        return false;
+    }
+
+    // exactly one innermost loop in simplified form
+    if (L->getSubLoops().size() != 1 || !L->getSubLoops()[0]->empty()) {
+        DEBUG(dbgs() << "  no unroll-and-jam: not a two-deep loop nest\n");
+        return false;
+    }
+    Loop *SubL = L->getSubLoops()[0];
+    BasicBlock *SubPreHeader = SubL->getLoopPreheader();
+    BasicBlock *SubLatch = SubL->getLoopLatch();
+    BasicBlock *SubExit = SubL->getExitBlock();
+    if (!SubPreHeader || !SubLatch || !SubExit ||
+        SubL->getExitingBlock() != SubLatch ||
+        SubExit->getSinglePredecessor() != SubLatch) {
+        DEBUG(dbgs() << "  no unroll-and-jam: inner loop not in simplified form\n");
+        return false;
+    }
+
+    BranchInst *SubBI = dyn_cast<BranchInst>(SubLatch->getTerminator());
+    if (!SubBI || SubBI->isUnconditional()) {
+        DEBUG(dbgs() << "  no unroll-and-jam: inner loop not terminated by a conditional branch\n");
+        return false;
+    }
+
+    // the copies of the outer latch become unconditional
+    unsigned TripMultiple = SE->getSmallConstantTripMultiple(L, LatchBlock);
+    DEBUG(dbgs() << "  outer trip multiple = " << TripMultiple << "\n");
+    if (TripMultiple % Count != 0) {
+        DEBUG(dbgs() << "  no unroll-and-jam: outer trip count not a multiple of " << Count << "\n");
+        return false;
+    }
+
+    // the copies of the inner loop share one exit test
+    const SCEV *SubBECount = SE->getBackedgeTakenCount(SubL);
+    if (isa<SCEVCouldNotCompute>(SubBECount) || !SE->isLoopInvariant(SubBECount, L)) {
+        DEBUG(dbgs() << "  no unroll-and-jam: inner trip count varies with the outer loop\n");
+        return false;
+    }
+
+    SmallPtrSet<BasicBlock *, 8> Fore, Aft;
+    if (!partitionBlocks(L, SubL, DT, Fore, Aft)) {
+        DEBUG(dbgs() << "  no unroll-and-jam: blocks around the inner loop are conditional\n");
+        return false;
+    }
+
+    // the next copy of the fore blocks runs before the aft blocks, so the
+    // outer recurrences have to be computed in the fore blocks, or be
+    // reductions over the inner loop
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        Value *InVal = PN->getIncomingValueForBlock(LatchBlock);
+
+        JamReduction Red;
+        if (findReduction(PN, L, SubL, Red)) {
+            Plan.Reductions.push_back(Red);
+        } else if (!collectMovable(InVal, Aft, Plan.ToMove)) {
+            DEBUG(dbgs() << "  no unroll-and-jam: outer recurrence depends on the inner loop\n");
+            return false;
+        }
+    }
+
+    if (!checkDependences(L, SubL, Fore, DI)) {
+        DEBUG(dbgs() << "  no unroll-and-jam: prevented by dependences\n");
+        return false;
+    }
+
+    return true;
+}
+
+// returns true if the nest of L can be unrolled by Count and jammed
+bool canUnrollAndJamLoop(Loop *L, unsigned Count, DominatorTree *DT,
+                         ScalarEvolution *SE, DependenceInfo *DI)
+{
+    JamPlan Plan;
+    return planUnrollAndJam(L, Count, DT, SE, DI, Plan);
+}
+
+// unroll the outer loop L by Count and jam the copies of its inner loop into a
+// single inner loop. for a nest
+//
+//   for (i = 0; i < N; i++) { fore(i); for (j ...) sub(i, j); aft(i); }
+//
+// and Count = 2 this gives
+//
+//   for (i = 0; i < N; i += 2) {
+//       fore(i); fore(i + 1);
+//       for (j ...) { sub(i, j); sub(i + 1, j); }
+//       aft(i); aft(i + 1);
+//   }
+//
+// the outer trip count must be a known multiple of Count, the inner trip count
+// must be the same in all outer iterations, and the reordering of fore, sub and
+// aft must be allowed by the dependences between them.
+// returns true if the transformation was performed
+bool unrollAndJamLoop(Loop *L, unsigned Count, LoopInfo *LI, DominatorTree *DT,
+                      ScalarEvolution *SE, DependenceInfo *DI, AssumptionCache *AC)
+{
+    JamPlan Plan;
+    if (!planUnrollAndJam(L, Count, DT, SE, DI, Plan)) {
+        return false;
+    }
+    SmallSetVector<Instruction *, 8> &ToMove = Plan.ToMove;
+    std::vector<JamReduction> &Reductions = Plan.Reductions;
+
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *LatchBlock = L->getLoopLatch();
+    BranchInst *BI = cast<BranchInst>(LatchBlock->getTerminator());
+    Loop *SubL = L->getSubLoops()[0];
+    BasicBlock *SubPreHeader = SubL->getLoopPreheader();
+    BasicBlock *SubHeader = SubL->getHeader();
+    BasicBlock *SubLatch = SubL->getLoopLatch();
+    BasicBlock *SubExit = SubL->getExitBlock();
+    BranchInst *SubBI = cast<BranchInst>(SubLatch->getTerminator());
+
+    DEBUG(dbgs() << "UNROLL-AND-JAM by " << Count << "\n");
+    if (!Reductions.empty()) {
+        DEBUG(dbgs() << "  with " << Reductions.size() << " inner loop reductions\n");
+    }
+
+    // compute the outer recurrences before the inner loop
+    for (Instruction *I : ToMove) {
+        I->moveBefore(SubPreHeader->getTerminator());
+    }
+
+    bool ContinueOnTrue = L->contains(BI->getSuccessor(0));
+    BasicBlock *LoopExit = BI->getSuccessor(ContinueOnTrue);
+    bool SubContinueOnTrue = SubL->contains(SubBI->getSuccessor(0));
+
+    // first iteration uses the original values in place of the header phis
+    ValueToValueMapTy LastValueMap;
+    std::vector<PHINode*> OrigPHINode;
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        OrigPHINode.push_back(PN);
+
+        if (Instruction *InValI = dyn_cast<Instruction>(PN->getIncomingValueForBlock(LatchBlock))) {
+            if (L->contains(InValI->getParent())) {
+                LastValueMap[InValI] = InValI;
+            }
+        }
+    }
+
+    // the copies of each interesting block, copy 0 being the original
+    std::vector<BasicBlock*> Headers(1, Header), Latches(1, LatchBlock);
+    std::vector<BasicBlock*> SubPreHeaders(1, SubPreHeader), SubHeaders(1, SubHeader);
+    std::vector<BasicBlock*> SubLatches(1, SubLatch), SubExits(1, SubExit);
+    std::vector<std::vector<PHINode*> > InnerPHIs(Reductions.size());
+    std::vector<std::vector<PHINode*> > ExitPHIs(Reductions.size());
+    for (unsigned r = 0; r != Reductions.size(); ++r) {
+        InnerPHIs[r].push_back(Reductions[r].InnerPHI);
+        ExitPHIs[r].push_back(Reductions[r].ExitPHI);
+    }
+
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+
+    // unroll the whole body, as unrollLoop does
+    for (unsigned It = 1; It != Count; ++It) {
+        std::vector<BasicBlock*> NewBlocks;
+
+        for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+            ValueToValueMapTy VMap;
+            BasicBlock *New = CloneBasicBlock(*BB, VMap, "." + Twine(It));
+            Header->getParent()->getBasicBlockList().push_back(New);
+
+            // the copies of the inner loop are jammed into the inner loop
+            if (SubL->contains(*BB)) {
+                SubL->addBasicBlockToLoop(New, *LI);
+            } else {
+                L->addBasicBlockToLoop(New, *LI);
+            }
+
+            // the outer header phis take the values of the previous copy
+            if (*BB == Header) {
+                for (PHINode *OrigPHI : OrigPHINode) {
+                    PHINode *NewPHI = cast<PHINode>(VMap[OrigPHI]);
+                    Value *InVal = NewPHI->getIncomingValueForBlock(LatchBlock);
+
+                    if (Instruction *InValI = dyn_cast<Instruction>(InVal)) {
+                        if (It > 1 && L->contains(InValI)) {
+                            InVal = LastValueMap[InValI];
+                        }
+                    }
+                    VMap[OrigPHI] = InVal;
+                    New->getInstList().erase(NewPHI);
+                }
+            }
+
+            LastValueMap[*BB] = New;
+            for (ValueToValueMapTy::iterator VI = VMap.begin(), VE = VMap.end();
+                 VI != VE; ++VI) {
+                LastValueMap[VI->first] = VI->second;
+            }
+
+            if (*BB == Header)
+                Headers.push_back(New);
+            if (*BB == LatchBlock)
+                Latches.push_back(New);
+            if (*BB == SubPreHeader)
+                SubPreHeaders.push_back(New);
+            if (*BB == SubHeader)
+                SubHeaders.push_back(New);
+            if (*BB == SubLatch)
+                SubLatches.push_back(New);
+            if (*BB == SubExit)
+                SubExits.push_back(New);
+
+            NewBlocks.push_back(New);
+        }
+
+        for (BasicBlock *NewBlock : NewBlocks) {
+            for (Instruction &I : *NewBlock) {
+                remapInstruction(&I, LastValueMap);
+
+                if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+                    if (II->getIntrinsicID() == Intrinsic::assume) {
+                        AC->registerAssumption(II);
+                    }
+                }
+            }
+        }
+
+        for (unsigned r = 0; r != Reductions.size(); ++r) {
+            InnerPHIs[r].push_back(cast<PHINode>(LastValueMap[Reductions[r].InnerPHI]));
+            ExitPHIs[r].push_back(cast<PHINode>(LastValueMap[Reductions[r].ExitPHI]));
+        }
+    }
+
+    // the outer loop continues from the last copy
+    for (PHINode *PN : OrigPHINode) {
+        int Idx = PN->getBasicBlockIndex(LatchBlock);
+        Value *InVal = PN->getIncomingValue(Idx);
+        if (Instruction *InValI = dyn_cast<Instruction>(InVal)) {
+            if (L->contains(InValI->getParent())) {
+                PN->setIncomingValue(Idx, LastValueMap[InValI]);
+            }
+        }
+        PN->setIncomingBlock(Idx, Latches.back());
+    }
+
+    for (BasicBlock::iterator I = LoopExit->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        int Idx = PN->getBasicBlockIndex(LatchBlock);
+        Value *InVal = PN->getIncomingValue(Idx);
+        if (Instruction *InValI = dyn_cast<Instruction>(InVal)) {
+            if (L->contains(InValI->getParent())) {
+                PN->setIncomingValue(Idx, LastValueMap[InValI]);
+            }
+        }
+        PN->setIncomingBlock(Idx, Latches.back());
+    }
+
+    // chain the copies: all fore blocks, the jammed inner loop, all aft blocks
+    SmallVector<Value *, 8> DeadConditions;
+    for (unsigned k = 0; k != Count; ++k) {
+        bool Last = k + 1 == Count;
+
+        BranchInst *ForeTerm = cast<BranchInst>(SubPreHeaders[k]->getTerminator());
+        ForeTerm->setSuccessor(0, Last ? SubHeaders[0] : Headers[k + 1]);
+
+        BranchInst *SubTerm = cast<BranchInst>(SubLatches[k]->getTerminator());
+        if (Last) {
+            SubTerm->setSuccessor(SubContinueOnTrue ? 0 : 1, SubHeaders[0]);
+            SubTerm->setSuccessor(SubContinueOnTrue ? 1 : 0, SubExits[0]);
+        } else {
+            DeadConditions.push_back(SubTerm->getCondition());
+            BranchInst::Create(SubHeaders[k + 1], SubTerm);
+            SubTerm->eraseFromParent();
+        }
+
+        BranchInst *Term = cast<BranchInst>(Latches[k]->getTerminator());
+        if (Last) {
+            Term->setSuccessor(ContinueOnTrue ? 0 : 1, Headers[0]);
+        } else {
+            DeadConditions.push_back(Term->getCondition());
+            BranchInst::Create(SubExits[k + 1], Term);
+            Term->eraseFromParent();
+        }
+    }
+
+    // the inner header and exit phis of all copies move to the jammed loop
+    for (unsigned k = 0; k != Count; ++k) {
+        std::vector<PHINode*> PHIs;
+        for (BasicBlock::iterator I = SubHeaders[k]->begin(); isa<PHINode>(I); ++I) {
+            PHIs.push_back(cast<PHINode>(I));
+        }
+        for (PHINode *PN : PHIs) {
+            PN->setIncomingBlock(PN->getBasicBlockIndex(SubPreHeaders[k]), SubPreHeaders.back());
+            PN->setIncomingBlock(PN->getBasicBlockIndex(SubLatches[k]), SubLatches.back());
+            if (k != 0) {
+                PN->moveBefore(SubHeaders[0]->getFirstNonPHI());
+            }
+        }
+
+        PHIs.clear();
+        for (BasicBlock::iterator I = SubExits[k]->begin(); isa<PHINode>(I); ++I) {
+            PHIs.push_back(cast<PHINode>(I));
+        }
+        for (PHINode *PN : PHIs) {
+            PN->setIncomingBlock(0, SubLatches.back());
+            if (k != 0) {
+                PN->moveBefore(SubExits[0]->getFirstNonPHI());
+            }
+        }
+    }
+
+    // copies after the first accumulate from the identity, and their results
+    // are combined in the aft blocks
+    for (unsigned r = 0; r != Reductions.size(); ++r) {
+        Instruction *Op = Reductions[r].Op;
+        Constant *Identity = ConstantExpr::getBinOpIdentity(Op->getOpcode(), Op->getType());
+
+        Value *Prev = ExitPHIs[r][0];
+        for (unsigned k = 1; k != Count; ++k) {
+            PHINode *ExitPHI = ExitPHIs[r][k];
+            Instruction *Combined =
+                BinaryOperator::Create((Instruction::BinaryOps) Op->getOpcode(), Prev,
+                                       UndefValue::get(Op->getType()),
+                                       Op->getName() + ".jam",
+                                       &*SubExits[k]->getFirstInsertionPt());
+            ExitPHI->replaceAllUsesWith(Combined);
+            Combined->setOperand(1, ExitPHI);
+
+            PHINode *InnerPHI = InnerPHIs[r][k];
+            InnerPHI->setIncomingValue(InnerPHI->getBasicBlockIndex(SubPreHeaders.back()),
+                                       Identity);
+            Prev = Combined;
+        }
+    }
+
+    for (Value *Cond : DeadConditions) {
+        RecursivelyDeleteTriviallyDeadInstructions(Cond);
+    }
+
+    DT->recalculate(*Header->getParent());
+    SE->forgetLoop(L);
+
+    return true;
+}
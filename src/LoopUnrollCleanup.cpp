@@ -0,0 +1,243 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/Analysis/Loads.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/SimplifyIndVar.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<unsigned> UnrollCleanupRounds ("my-unroll-cleanup-rounds", cl::init(4), cl::Hidden,
+                                              cl::desc("Largest number of rounds of the cleanup after unrolling"));
+
+static cl::opt<unsigned> UnrollCleanupScan ("my-unroll-cleanup-scan", cl::init(128), cl::Hidden,
+                                            cl::desc("Instructions scanned back from a load for a store or load it repeats"));
+
+
+// helper functions
+
+// constant folding and trivial dead code elimination
+static bool simplifyInstructions(Loop *L, LoopInfo *LI, DominatorTree *DT,
+                                 AssumptionCache *AC)
+{
+    bool Changed = false;
+    const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+
+    for (BasicBlock *BB : L->getBlocks()) {
+        for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ) {
+            Instruction *Inst = &*I++;
+
+            if (!Inst->use_empty()) {
+                if (Value *V = SimplifyInstruction(Inst, DL, nullptr, DT, AC)) {
+                    if (LI->replacementPreservesLCSSAForm(Inst, V)) {
+                        Inst->replaceAllUsesWith(V);
+                        Changed = true;
+                    }
+                }
+            }
+
+            if (isInstructionTriviallyDead(Inst)) {
+                BB->getInstList().erase(Inst);
+                Changed = true;
+            }
+        }
+    }
+
+    return Changed;
+}
+
+// rewrites (x + c1) + c2 as x + (c1 + c2). the copies step the induction
+// variable one after another, this makes each of them a single add from the
+// value at the start of the unrolled iteration
+static bool combineConstantOffsets(Loop *L)
+{
+    bool Changed = false;
+
+    for (BasicBlock *BB : L->getBlocks()) {
+        for (Instruction &I : *BB) {
+            BinaryOperator *Outer = dyn_cast<BinaryOperator>(&I);
+            if (!Outer || Outer->getOpcode() != Instruction::Add) {
+                continue;
+            }
+            ConstantInt *C2 = dyn_cast<ConstantInt>(Outer->getOperand(1));
+            BinaryOperator *Inner = dyn_cast<BinaryOperator>(Outer->getOperand(0));
+            if (!C2 || !Inner || Inner->getOpcode() != Instruction::Add ||
+                !L->contains(Inner->getParent())) {
+                continue;
+            }
+            ConstantInt *C1 = dyn_cast<ConstantInt>(Inner->getOperand(1));
+            if (!C1) {
+                continue;
+            }
+
+            // the flags hold for the sum if they hold for both steps, and the
+            // steps go in the same direction
+            bool SignedOverflow, UnsignedOverflow;
+            APInt Sum = C1->getValue().sadd_ov(C2->getValue(), SignedOverflow);
+            C1->getValue().uadd_ov(C2->getValue(), UnsignedOverflow);
+            bool NSW = Outer->hasNoSignedWrap() && Inner->hasNoSignedWrap() &&
+                !SignedOverflow && C1->isNegative() == C2->isNegative();
+            bool NUW = Outer->hasNoUnsignedWrap() && Inner->hasNoUnsignedWrap() &&
+                !UnsignedOverflow;
+
+            Outer->setOperand(0, Inner->getOperand(0));
+            Outer->setOperand(1, ConstantInt::get(C2->getType(), Sum));
+            Outer->setHasNoSignedWrap(NSW);
+            Outer->setHasNoUnsignedWrap(NUW);
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
+
+// replaces loads by the value stored to or loaded from the same address
+// earlier in the block, if nothing in between may write to it. after the
+// copies are folded into one block, this forwards the stores of one
+// iteration to the loads of the next
+static bool forwardLoads(Loop *L, AliasAnalysis *AA)
+{
+    bool Changed = false;
+
+    for (BasicBlock *BB : L->getBlocks()) {
+        for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ) {
+            LoadInst *Load = dyn_cast<LoadInst>(&*I++);
+            if (!Load || !Load->isSimple()) {
+                continue;
+            }
+
+            BasicBlock::iterator ScanFrom = Load->getIterator();
+            bool IsLoadCSE;
+            Value *V = FindAvailableLoadedValue(Load, BB, ScanFrom, UnrollCleanupScan,
+                                                AA, &IsLoadCSE);
+            if (!V || V->getType() != Load->getType()) {
+                continue;
+            }
+
+            if (IsLoadCSE) {
+                combineMetadataForCSE(cast<LoadInst>(V), Load);
+            }
+            Load->replaceAllUsesWith(V);
+            Load->eraseFromParent();
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
+
+// folds the branches inside L on constant conditions, and deletes the blocks
+// of L that are no longer reached. the backedge and the exits are left alone,
+// as are the blocks of subloops
+static bool removeDeadBlocks(Loop *L, LoopInfo *LI)
+{
+    bool Changed = false;
+    BasicBlock *Header = L->getHeader();
+
+    std::vector<BasicBlock*> Blocks = L->getBlocks();
+    for (BasicBlock *BB : Blocks) {
+        BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        if (!BI || BI->isUnconditional() || !isa<ConstantInt>(BI->getCondition())) {
+            continue;
+        }
+
+        BasicBlock *T = BI->getSuccessor(0);
+        BasicBlock *F = BI->getSuccessor(1);
+        if (L->contains(T) && L->contains(F) && T != Header && F != Header) {
+            Changed |= ConstantFoldTerminator(BB);
+        }
+    }
+
+    SmallVector<BasicBlock*, 8> Worklist;
+    for (BasicBlock *BB : L->getBlocks()) {
+        if (BB != Header && pred_empty(BB) && LI->getLoopFor(BB) == L) {
+            Worklist.push_back(BB);
+        }
+    }
+
+    while (!Worklist.empty()) {
+        BasicBlock *BB = Worklist.pop_back_val();
+
+        for (BasicBlock *Succ : successors(BB)) {
+            Succ->removePredecessor(BB);
+            if (LI->getLoopFor(Succ) == L && Succ != Header && pred_empty(Succ) &&
+                std::find(Worklist.begin(), Worklist.end(), Succ) == Worklist.end()) {
+                Worklist.push_back(Succ);
+            }
+        }
+
+        // only dead blocks can still use the values of a dead block
+        for (Instruction &I : *BB) {
+            if (!I.use_empty()) {
+                I.replaceAllUsesWith(UndefValue::get(I.getType()));
+            }
+        }
+
+        LI->removeBlock(BB);
+        BB->eraseFromParent();
+        Changed = true;
+    }
+
+    return Changed;
+}
+
+
+// cleans up the unrolled body of L until nothing changes, or for at most
+// -my-unroll-cleanup-rounds rounds. each round simplifies the induction
+// variables if L is still a loop, combines the steps of the copies, folds
+// constants, forwards stores and loads to later loads, and deletes dead
+// blocks
+void cleanupUnrolledLoop(Loop *L, LoopInfo *LI, DominatorTree *DT,
+                         ScalarEvolution *SE, AssumptionCache *AC, AliasAnalysis *AA)
+{
+    unsigned Rounds = 0;
+    bool Changed = true;
+    while (Changed && Rounds != UnrollCleanupRounds) {
+        Changed = false;
+        Rounds++;
+
+        if (L->getNumBackEdges() != 0 && L->getLoopPreheader()) {
+            SmallVector<WeakVH, 16> Dead;
+            Changed |= simplifyLoopIVs(L, SE, DT, LI, Dead);
+            for (WeakVH &V : Dead) {
+                if (Instruction *I = dyn_cast_or_null<Instruction>(V)) {
+                    RecursivelyDeleteTriviallyDeadInstructions(I);
+                }
+            }
+        }
+
+        Changed |= combineConstantOffsets(L);
+        Changed |= simplifyInstructions(L, LI, DT, AC);
+        Changed |= forwardLoads(L, AA);
+
+        if (removeDeadBlocks(L, LI)) {
+            if (DT) {
+                DT->recalculate(*L->getHeader()->getParent());
+            }
+            Changed = true;
+        }
+
+        if (Changed) {
+            SE->forgetLoop(L);
+        }
+    }
+
+    DEBUG(dbgs() << "  cleanup rounds = " << Rounds << "\n");
+}
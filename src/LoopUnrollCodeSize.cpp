@@ -0,0 +1,150 @@
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<std::string> UnrollCPU ("my-unroll-cpu", cl::init(""), cl::Hidden,
+                                       cl::desc("Use the front end sizes of this CPU instead of the function's target-cpu"));
+
+static cl::opt<bool> UnrollFrontEnd ("my-unroll-front-end", cl::init(true), cl::Hidden,
+                                     cl::desc("Limit automatic unroll counts so the loop fits in the loop stream detector, uop cache or L1i"));
+
+
+// helper functions
+
+// sizes of the structures that feed the decoders, as seen by a single loop.
+// a loop that fits in the loop stream detector (LSD) is replayed from the
+// instruction queue, one that fits in the decoded uop cache (DSB) skips the
+// legacy decoders, anything larger is decoded from the L1 instruction cache
+struct FrontEndSizes
+{
+    const char *CPU;
+    unsigned LSDUops;       // zero if there is none, or it is disabled
+    unsigned DSBUops;
+    unsigned L1iBytes;
+};
+
+static const FrontEndSizes FrontEndTable[] = {
+    { "generic",        28, 1536, 32 * 1024 },
+    { "nehalem",        28,    0, 32 * 1024 },
+    { "westmere",       28,    0, 32 * 1024 },
+    { "sandybridge",    28, 1536, 32 * 1024 },
+    { "ivybridge",      56, 1536, 32 * 1024 },
+    { "haswell",        56, 1536, 32 * 1024 },
+    { "broadwell",      56, 1536, 32 * 1024 },
+    { "skylake",         0, 1536, 32 * 1024 },
+    { "skylake-avx512",  0, 1536, 32 * 1024 },
+    { "znver1",          0, 2048, 64 * 1024 },
+    { "btver2",          0,    0, 32 * 1024 },
+};
+
+static const FrontEndSizes &getFrontEndSizes(const Function *F)
+{
+    StringRef CPU = UnrollCPU;
+    if (CPU.empty() && F->hasFnAttribute("target-cpu")) {
+        CPU = F->getFnAttribute("target-cpu").getValueAsString();
+    }
+
+    for (const FrontEndSizes &Sizes : FrontEndTable) {
+        if (CPU == Sizes.CPU) {
+            return Sizes;
+        }
+    }
+    return FrontEndTable[0];
+}
+
+// returns true if I is a compare that the decoders fuse with the branch using
+// it, so that both take a single uop
+static bool isFusedCompare(const Instruction *I)
+{
+    if (!isa<CmpInst>(I) || !I->hasOneUse()) {
+        return false;
+    }
+    const BranchInst *BI = dyn_cast<BranchInst>(*I->user_begin());
+    return BI && BI->getParent() == I->getParent();
+}
+
+// estimates the uops and bytes of machine code for one iteration of L. every
+// instruction costs as many uops as its TTI cost, and an x86 instruction is
+// about four bytes, plus a prefix for vector operations and an address for
+// memory accesses
+static void estimateCodeSize(Loop *L, const TargetTransformInfo &TTI,
+                             unsigned &Uops, unsigned &Bytes)
+{
+    Uops = 0;
+    Bytes = 0;
+
+    for (BasicBlock *BB : L->blocks()) {
+        for (Instruction &I : *BB) {
+            if (isa<PHINode>(I) || isFusedCompare(&I)) {
+                continue;
+            }
+
+            unsigned Cost = TTI.getUserCost(&I);
+            if (Cost == TargetTransformInfo::TCC_Free) {
+                continue;
+            }
+
+            Uops += Cost;
+            Bytes += 4;
+            if (I.getType()->isVectorTy()) {
+                Bytes += 1;
+            }
+            if (I.mayReadOrWriteMemory()) {
+                Bytes += 2;
+            }
+        }
+    }
+
+    // the decoders need at least the backedge branch
+    Uops = std::max(Uops, 1u);
+    Bytes = std::max(Bytes, 2u);
+}
+
+
+// returns the largest unroll count for which the unrolled body of L still
+// runs from the same front end structure as the original loop: the loop
+// stream detector if it fits there, else the uop cache, else the L1i
+unsigned computeFrontEndLimit(Loop *L, const TargetTransformInfo &TTI)
+{
+    if (!UnrollFrontEnd) {
+        return UINT_MAX;
+    }
+
+    const FrontEndSizes &Sizes = getFrontEndSizes(L->getHeader()->getParent());
+
+    unsigned Uops, Bytes;
+    estimateCodeSize(L, TTI, Uops, Bytes);
+
+    unsigned Limit;
+    const char *Structure;
+    if (Uops <= Sizes.LSDUops) {
+        Limit = Sizes.LSDUops / Uops;
+        Structure = "LSD";
+    } else if (Uops <= Sizes.DSBUops) {
+        Limit = Sizes.DSBUops / Uops;
+        Structure = "DSB";
+    } else {
+        Limit = std::max(1u, Sizes.L1iBytes / Bytes);
+        Structure = "L1i";
+    }
+
+    DEBUG(dbgs() << "  auto: " << Structure << " allows " << Limit
+                 << " (uops = " << Uops << ", bytes = " << Bytes
+                 << ", cpu = " << Sizes.CPU << ")\n");
+
+    return Limit;
+}
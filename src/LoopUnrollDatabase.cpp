@@ -0,0 +1,163 @@
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <mutex>
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<std::string> UnrollDatabase ("my-unroll-db", cl::init(""), cl::Hidden,
+                                            cl::desc("File of tuned unroll counts per loop, see utils/autotune.sh"));
+
+static cl::opt<bool> UnrollDatabaseRecord ("my-unroll-db-record", cl::init(false), cl::Hidden,
+                                           cl::desc("Append the loops missing from -my-unroll-db to it, with count 0"));
+
+
+// helper functions
+
+// the tuned counts by fingerprint, read once from -my-unroll-db
+static StringMap<unsigned> TunedCounts;
+static bool DatabaseLoaded = false;
+static std::mutex DatabaseMutex;
+
+// 64 bit FNV-1a, which unlike hash_combine is the same in every build
+static uint64_t hashValue(uint64_t Hash, uint64_t Value)
+{
+    for (unsigned i = 0; i != 8; ++i) {
+        Hash ^= (Value >> (8 * i)) & 0xff;
+        Hash *= 0x100000001b3ULL;
+    }
+    return Hash;
+}
+
+// reads the database. each line is "<function> <header> <hash> <count>",
+// empty lines and lines starting with # are skipped
+static void loadDatabase()
+{
+    DatabaseLoaded = true;
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr = MemoryBuffer::getFile(UnrollDatabase);
+    if (!BufferOrErr) {
+        // recording starts from an empty database
+        if (!UnrollDatabaseRecord) {
+            report_fatal_error("cannot read -my-unroll-db '" + UnrollDatabase + "'");
+        }
+        return;
+    }
+
+    SmallVector<StringRef, 16> Lines;
+    (*BufferOrErr)->getBuffer().split(Lines, '\n', -1, false);
+    for (StringRef Line : Lines) {
+        Line = Line.trim();
+        if (Line.empty() || Line.startswith("#")) {
+            continue;
+        }
+
+        SmallVector<StringRef, 4> Fields;
+        Line.split(Fields, ' ', -1, false);
+        unsigned Count;
+        if (Fields.size() != 4 || Fields[3].getAsInteger(10, Count)) {
+            report_fatal_error("invalid line in -my-unroll-db: '" + Line + "'");
+        }
+        TunedCounts[Fields[0].str() + " " + Fields[1].str() + " " + Fields[2].str()] = Count;
+    }
+}
+
+
+// returns the fingerprint of L: its function, its header and a hash of the
+// instructions in its own blocks. the hash covers opcodes, types and
+// constant operands, so it is stable across builds of the same IR but
+// changes when the loop does. headers without a name are named by their
+// position in the function
+std::string getLoopFingerprint(Loop *L)
+{
+    BasicBlock *Header = L->getHeader();
+    Function *F = Header->getParent();
+
+    std::string HeaderName = Header->getName().str();
+    if (HeaderName.empty()) {
+        unsigned Index = 0;
+        for (BasicBlock &BB : *F) {
+            if (&BB == Header) {
+                break;
+            }
+            Index++;
+        }
+        HeaderName = "bb" + std::to_string(Index);
+    }
+
+    uint64_t Hash = 0xcbf29ce484222325ULL;
+    for (BasicBlock *BB : L->getBlocks()) {
+        Hash = hashValue(Hash, BB->size());
+        for (Instruction &I : *BB) {
+            Hash = hashValue(Hash, I.getOpcode());
+            Hash = hashValue(Hash, I.getType()->getTypeID());
+            Hash = hashValue(Hash, I.getNumOperands());
+            for (Value *Op : I.operands()) {
+                if (ConstantInt *C = dyn_cast<ConstantInt>(Op)) {
+                    // by words, as constants may be wider than 64 bits
+                    const APInt &V = C->getValue();
+                    for (unsigned w = 0; w != V.getNumWords(); ++w) {
+                        Hash = hashValue(Hash, V.getRawData()[w]);
+                    }
+                }
+            }
+        }
+    }
+
+    std::string Fingerprint;
+    raw_string_ostream OS(Fingerprint);
+    OS << F->getName() << " " << HeaderName << " ";
+    OS.write_hex(Hash);
+    return OS.str();
+}
+
+// returns the count stored for L in -my-unroll-db, or zero if there is no
+// database, no entry for L or the entry is not tuned yet. with
+// -my-unroll-db-record, loops without an entry are appended with count 0
+unsigned getTunedUnrollCount(Loop *L)
+{
+    if (UnrollDatabase.empty()) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> Lock(DatabaseMutex);
+    if (!DatabaseLoaded) {
+        loadDatabase();
+    }
+
+    std::string Fingerprint = getLoopFingerprint(L);
+    auto It = TunedCounts.find(Fingerprint);
+    if (It != TunedCounts.end()) {
+        return It->second;
+    }
+
+    DEBUG(dbgs() << "  no tuned count for " << Fingerprint << "\n");
+
+    if (UnrollDatabaseRecord) {
+        std::error_code EC;
+        raw_fd_ostream Out(UnrollDatabase, EC, sys::fs::F_Append | sys::fs::F_Text);
+        if (EC) {
+            report_fatal_error("cannot write -my-unroll-db '" + UnrollDatabase + "': " + EC.message());
+        }
+        Out << Fingerprint << " 0\n";
+        TunedCounts[Fingerprint] = 0;
+    }
+
+    return 0;
+}
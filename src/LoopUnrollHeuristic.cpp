@@ -0,0 +1,352 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<unsigned> UnrollIssueWidth ("my-unroll-issue-width", cl::init(4), cl::Hidden,
+                                           cl::desc("Instructions issued per cycle, used to find loops bound by a recurrence"));
+
+static cl::opt<unsigned> UnrollDefaultThreshold ("my-unroll-default-threshold", cl::init(150), cl::Hidden,
+                                                 cl::desc("Size limit for complete unrolling when no threshold is given"));
+
+
+// helper functions
+
+// returns true if values of type Ty are held in vector registers. floating
+// point values share the vector register file on most targets
+static bool usesVectorRegister(Type *Ty, const TargetTransformInfo &TTI)
+{
+    if (TTI.getNumberOfRegisters(true) == 0) {
+        return false;
+    }
+    return Ty->isVectorTy() || Ty->isFloatingPointTy();
+}
+
+// estimate the number of registers needed by one iteration of the loop.
+// Invariant is the number of values defined outside and used inside the loop,
+// MaxLive the largest number of loop values live at the same time, when the
+// blocks are laid out in reverse post order
+static void estimateRegisterPressure(Loop *L, LoopInfo *LI,
+                                     const TargetTransformInfo &TTI,
+                                     unsigned Invariant[2], unsigned MaxLive[2])
+{
+    Invariant[0] = Invariant[1] = 0;
+    MaxLive[0] = MaxLive[1] = 0;
+
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+
+    // number every instruction in layout order
+    DenseMap<const Instruction *, unsigned> Index;
+    std::vector<Instruction *> Insts;
+    for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+        for (Instruction &I : **BB) {
+            Index[&I] = Insts.size();
+            Insts.push_back(&I);
+        }
+    }
+    unsigned End = Insts.size();
+
+    // the end of each live range. values used by a header phi or outside the
+    // loop are live until the end of the iteration, phis from its start
+    std::vector<unsigned> LastUse(End, 0);
+    SmallPtrSet<const Value *, 16> Invariants;
+    for (unsigned Idx = 0; Idx != End; ++Idx) {
+        Instruction *I = Insts[Idx];
+        bool HeaderPHI = isa<PHINode>(I) && I->getParent() == L->getHeader();
+
+        for (Use &U : I->operands()) {
+            if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+                if (!L->contains(Op->getParent())) {
+                    // the initial value of a header phi is not live in the loop
+                    if (!HeaderPHI && Invariants.insert(Op).second) {
+                        Invariant[usesVectorRegister(Op->getType(), TTI)]++;
+                    }
+                } else if (HeaderPHI) {
+                    LastUse[Index[Op]] = End;
+                } else {
+                    LastUse[Index[Op]] = std::max(LastUse[Index[Op]], Idx);
+                }
+            } else if (isa<Argument>(U.get()) && !HeaderPHI) {
+                if (Invariants.insert(U.get()).second) {
+                    Invariant[usesVectorRegister(U->getType(), TTI)]++;
+                }
+            }
+        }
+
+        for (User *U : I->users()) {
+            if (!L->contains(cast<Instruction>(U)->getParent())) {
+                LastUse[Idx] = End;
+            }
+        }
+    }
+
+    // sweep over the layout, counting the ranges that overlap each point
+    std::vector<int> Delta[2];
+    Delta[0].assign(End + 2, 0);
+    Delta[1].assign(End + 2, 0);
+    for (unsigned Idx = 0; Idx != End; ++Idx) {
+        Instruction *I = Insts[Idx];
+        if (I->getType()->isVoidTy() || LastUse[Idx] == 0) {
+            continue;
+        }
+
+        bool Vector = usesVectorRegister(I->getType(), TTI);
+        unsigned Start = isa<PHINode>(I) ? 0 : Idx;
+        Delta[Vector][Start]++;
+        Delta[Vector][LastUse[Idx] + 1]--;
+    }
+
+    for (unsigned RC = 0; RC != 2; ++RC) {
+        int Live = 0;
+        for (unsigned Idx = 0; Idx <= End; ++Idx) {
+            Live += Delta[RC][Idx];
+            MaxLive[RC] = std::max(MaxLive[RC], (unsigned) Live);
+        }
+    }
+}
+
+// returns the length, in instructions, of the longest loop-carried dependence
+// chain: the path from a header phi through the loop to the value that phi
+// gets from the latch. induction variables are left out, as their increment
+// does not wait for the rest of the iteration, and so are reductions that are
+// split when unrolling, whose copies no longer depend on each other
+static unsigned getRecurrenceLength(Loop *L, LoopInfo *LI, ScalarEvolution *SE,
+                                    const TargetTransformInfo &TTI, bool SplitReductions)
+{
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!Latch) {
+        return 0;
+    }
+
+    std::vector<PHINode*> HeaderPHIs;
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+        HeaderPHIs.push_back(cast<PHINode>(I));
+    }
+
+    SmallPtrSet<PHINode*, 4> Split;
+    if (SplitReductions) {
+        std::vector<UnrollReduction> Reductions;
+        findReductions(L, HeaderPHIs, Reductions);
+        for (const UnrollReduction &R : Reductions) {
+            Split.insert(R.Phi);
+        }
+    }
+
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+
+    unsigned Length = 0;
+    for (PHINode *PN : HeaderPHIs) {
+        if (Split.count(PN) ||
+            (SE->isSCEVable(PN->getType()) && isa<SCEVAddRecExpr>(SE->getSCEV(PN)))) {
+            continue;
+        }
+
+        Instruction *In = dyn_cast<Instruction>(PN->getIncomingValueForBlock(Latch));
+        if (!In || !L->contains(In->getParent())) {
+            continue;
+        }
+
+        // depth of each instruction depending on PN
+        DenseMap<const Instruction *, unsigned> Depth;
+        Depth[PN] = 0;
+        for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+            for (Instruction &I : **BB) {
+                if (isa<PHINode>(I) && *BB == Header) {
+                    continue;
+                }
+
+                bool Dependent = false;
+                unsigned D = 0;
+                for (Use &U : I.operands()) {
+                    if (Instruction *Op = dyn_cast<Instruction>(U.get())) {
+                        auto It = Depth.find(Op);
+                        if (It != Depth.end()) {
+                            Dependent = true;
+                            D = std::max(D, It->second);
+                        }
+                    }
+                }
+
+                if (Dependent) {
+                    bool Free = TTI.getUserCost(&I) == TargetTransformInfo::TCC_Free;
+                    Depth[&I] = D + (Free ? 0 : 1);
+                }
+            }
+        }
+
+        auto It = Depth.find(In);
+        if (It != Depth.end()) {
+            Length = std::max(Length, It->second);
+        }
+    }
+
+    return Length;
+}
+
+// picks an unroll count for L, or zero if the loop should not be unrolled.
+//
+// complete unrolling is chosen if the trip count is known and the unrolled
+// size, or the size left after simplifying the copies (see
+// estimateUnrolledSize), stays within the threshold. otherwise the count is the largest one that
+//   - keeps the unrolled body within the target's partial unroll threshold
+//     (the loop stream detector size on x86),
+//   - keeps the estimated register pressure below the number of registers,
+//     assuming copies are interleaved so that their live values overlap,
+//   - keeps the unrolled body in the loop stream detector, uop cache or L1i
+//     if the original loop fits there (see computeFrontEndLimit),
+//   - is worth it: loops whose time is set by a recurrence gain nothing from
+//     more copies of the same dependence chain, unless the recurrence is a
+//     reduction that is split if SplitReductions is set, and
+//   - does not exceed the average trip count from the profile, if any.
+// functions optimized for size use the target's size thresholds instead.
+unsigned computeUnrollCount(Loop *L, uint64_t TripCount, unsigned TripMultiple,
+                            unsigned ProfileTripCount, unsigned LoopSize,
+                            unsigned Threshold, bool AllowRuntime, bool SplitReductions,
+                            LoopInfo *LI, ScalarEvolution *SE, const TargetTransformInfo &TTI)
+{
+    // set defaults and let the target override them
+    TargetTransformInfo::UnrollingPreferences UP = {};
+    UP.Threshold = UnrollDefaultThreshold;
+    UP.PartialThreshold = 0;
+    UP.OptSizeThreshold = 0;
+    UP.PartialOptSizeThreshold = 0;
+    UP.Count = 0;
+    UP.MaxCount = UINT_MAX;
+    UP.FullUnrollMaxCount = UINT_MAX;
+    UP.Partial = false;
+    UP.Runtime = false;
+    TTI.getUnrollingPreferences(L, UP);
+
+    if (L->getHeader()->getParent()->optForSize()) {
+        DEBUG(dbgs() << "  auto: optimizing for size\n");
+        UP.Threshold = UP.OptSizeThreshold;
+        UP.PartialThreshold = UP.PartialOptSizeThreshold;
+    }
+
+    if (Threshold > 0) {
+        UP.Threshold = Threshold;
+        UP.PartialThreshold = Threshold;
+    }
+
+    if (UP.Count > 0) {
+        DEBUG(dbgs() << "  auto: target count = " << UP.Count << "\n");
+        return UP.Count;
+    }
+
+    // complete unrolling, judged by the size once the copies are simplified
+    // if the raw size is too large
+    if (TripCount != 0 && TripCount <= UP.FullUnrollMaxCount) {
+        unsigned UnrolledSize;
+        if ((uint64_t) LoopSize * TripCount <= UP.Threshold) {
+            DEBUG(dbgs() << "  auto: complete unroll (threshold = " << UP.Threshold << ")\n");
+            return TripCount;
+        }
+        if (estimateUnrolledSize(L, TripCount, UP.Threshold, LI, TTI, UnrolledSize)) {
+            DEBUG(dbgs() << "  auto: complete unroll, simplified size = " << UnrolledSize
+                         << " (threshold = " << UP.Threshold << ")\n");
+            return TripCount;
+        }
+    }
+
+    // partial unrolling
+    if (!UP.Partial || UP.PartialThreshold == 0) {
+        DEBUG(dbgs() << "  auto: target does not want partial unrolling\n");
+        return 0;
+    }
+    // with a profile, run-time unrolling is decided by the average trip count
+    // below instead of the target's preference
+    bool Runtime = UP.Runtime || ProfileTripCount != 0;
+    if (TripCount == 0 && TripMultiple == 1 && !(AllowRuntime && Runtime)) {
+        DEBUG(dbgs() << "  auto: run-time trip count not allowed\n");
+        return 0;
+    }
+
+    // size budget
+    unsigned Count = UP.PartialThreshold / LoopSize;
+    DEBUG(dbgs() << "  auto: size allows " << Count
+                 << " (partial threshold = " << UP.PartialThreshold << ")\n");
+
+    // register pressure
+    unsigned Invariant[2], MaxLive[2];
+    estimateRegisterPressure(L, LI, TTI, Invariant, MaxLive);
+    for (unsigned RC = 0; RC != 2; ++RC) {
+        unsigned NumRegs = TTI.getNumberOfRegisters(RC);
+        if (MaxLive[RC] == 0 || NumRegs == 0) {
+            continue;
+        }
+
+        unsigned Available = NumRegs > Invariant[RC] ? NumRegs - Invariant[RC] : 0;
+        unsigned RegCount = std::max(1u, Available / MaxLive[RC]);
+        DEBUG(dbgs() << "  auto: " << (RC ? "vector" : "scalar") << " registers allow "
+                     << RegCount << " (live = " << MaxLive[RC]
+                     << ", invariant = " << Invariant[RC]
+                     << ", registers = " << NumRegs << ")\n");
+        Count = std::min(Count, RegCount);
+    }
+
+    // front end
+    Count = std::min(Count, computeFrontEndLimit(L, TTI));
+
+    // loop-carried dependences
+    unsigned Recurrence = getRecurrenceLength(L, LI, SE, TTI, SplitReductions);
+    if ((uint64_t) Recurrence * UnrollIssueWidth >= LoopSize) {
+        DEBUG(dbgs() << "  auto: bound by a recurrence of length " << Recurrence << "\n");
+        Count = 1;
+    }
+
+    // the unrolled loop should run at least once on an average entry, or all
+    // iterations end up in the prolog
+    if (TripCount == 0 && ProfileTripCount != 0) {
+        DEBUG(dbgs() << "  auto: profile trip count allows " << ProfileTripCount << "\n");
+        Count = std::min(Count, ProfileTripCount);
+    }
+
+    if (Count < 2) {
+        return 0;
+    }
+
+    // prefer counts that need no breakout or remainder, unless that gives up
+    // more than half of the copies, as for a prime trip count. the unrolled
+    // loop then leaves through breakout latches
+    if (TripCount != 0) {
+        Count = (unsigned) std::min<uint64_t>(Count, TripCount);
+        unsigned Divisor = Count;
+        while (Divisor > 1 && TripCount % Divisor != 0) {
+            Divisor--;
+        }
+        if (Divisor * 2 >= Count) {
+            Count = Divisor;
+        }
+    } else if (TripMultiple % Count != 0) {
+        Count = PowerOf2Floor(Count);
+    }
+
+    Count = std::min(Count, UP.MaxCount);
+    if (Count < 2) {
+        return 0;
+    }
+
+    DEBUG(dbgs() << "  auto: count = " << Count << "\n");
+
+    return Count;
+}
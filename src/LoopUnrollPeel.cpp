@@ -0,0 +1,238 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// helper functions
+
+// returns the number of iterations after which the header phi PN no longer
+// changes, or zero if it keeps changing. a phi that takes a loop invariant
+// value from the latch is invariant from the second iteration on, one that
+// takes another header phi one iteration after that phi
+static unsigned getIterationsToInvariance(PHINode *PN, Loop *L,
+                                          DenseMap<PHINode *, unsigned> &Cache)
+{
+    auto It = Cache.find(PN);
+    if (It != Cache.end()) {
+        return It->second;
+    }
+
+    // cut cycles between header phis
+    Cache[PN] = 0;
+
+    unsigned Iterations = 0;
+    Value *Input = PN->getIncomingValueForBlock(L->getLoopLatch());
+    if (L->isLoopInvariant(Input)) {
+        Iterations = 1;
+    } else if (PHINode *InPN = dyn_cast<PHINode>(Input)) {
+        if (InPN->getParent() == L->getHeader()) {
+            if (unsigned InIterations = getIterationsToInvariance(InPN, L, Cache)) {
+                Iterations = InIterations + 1;
+            }
+        }
+    }
+
+    Cache[PN] = Iterations;
+    return Iterations;
+}
+
+// clones the body of L once as iteration Iter, between InsertTop and
+// InsertBot. the header phis of the copy become the values of the previous
+// copy, in LastValueMap, or the initial values for the first one
+static void clonePeeledIteration(Loop *L, unsigned Iter, BasicBlock *InsertTop,
+                                 BasicBlock *InsertBot, BasicBlock *Exit,
+                                 LoopBlocksDFS &DFS, ValueToValueMapTy &LastValueMap,
+                                 LoopInfo *LI, AssumptionCache *AC)
+{
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *PreHeader = L->getLoopPreheader();
+    Function *F = Header->getParent();
+    Loop *ParentLoop = L->getParentLoop();
+
+    ValueToValueMapTy VMap;
+    std::vector<BasicBlock*> NewBlocks;
+    for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+        BasicBlock *New = CloneBasicBlock(*BB, VMap, ".peel", F, nullptr);
+        F->getBasicBlockList().insert(InsertBot->getIterator(), New);
+        VMap[*BB] = New;
+        if (ParentLoop) {
+            ParentLoop->addBasicBlockToLoop(New, *LI);
+        }
+        NewBlocks.push_back(New);
+    }
+
+    // the copy is entered from the top, and its backedge continues below it
+    InsertTop->getTerminator()->setSuccessor(0, cast<BasicBlock>(VMap[Header]));
+
+    BasicBlock *NewLatch = cast<BasicBlock>(VMap[Latch]);
+    BranchInst *LatchBR = cast<BranchInst>(NewLatch->getTerminator());
+    unsigned HeaderIdx = LatchBR->getSuccessor(0) == Header ? 0 : 1;
+    LatchBR->setSuccessor(HeaderIdx, InsertBot);
+    LatchBR->setSuccessor(1 - HeaderIdx, Exit);
+
+    // the header phis are resolved statically
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+        PHINode *NewPHI = cast<PHINode>(VMap[&*I]);
+        Value *InVal;
+        if (Iter == 0) {
+            InVal = NewPHI->getIncomingValueForBlock(PreHeader);
+        } else {
+            InVal = NewPHI->getIncomingValueForBlock(Latch);
+            Instruction *InValI = dyn_cast<Instruction>(InVal);
+            if (InValI && L->contains(InValI->getParent())) {
+                InVal = LastValueMap[InValI];
+            }
+        }
+        VMap[&*I] = InVal;
+        cast<BasicBlock>(VMap[Header])->getInstList().erase(NewPHI);
+    }
+
+    for (BasicBlock *NewBlock : NewBlocks) {
+        for (Instruction &I : *NewBlock) {
+            remapInstruction(&I, VMap);
+
+            if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+                if (II->getIntrinsicID() == Intrinsic::assume) {
+                    AC->registerAssumption(II);
+                }
+            }
+        }
+    }
+
+    // the copy may leave the loop, after the header phis are resolved since
+    // the value leaving the latch may be one of them
+    for (BasicBlock::iterator I = Exit->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        Value *InVal = PN->getIncomingValueForBlock(Latch);
+        Instruction *InValI = dyn_cast<Instruction>(InVal);
+        if (InValI && L->contains(InValI->getParent())) {
+            InVal = VMap[InValI];
+        }
+        PN->addIncoming(InVal, NewLatch);
+    }
+
+    for (ValueToValueMapTy::iterator VI = VMap.begin(), VE = VMap.end(); VI != VE; ++VI) {
+        LastValueMap[VI->first] = VI->second;
+    }
+}
+
+
+// returns the number of iterations to peel so that all header phis that
+// become invariant do so before the loop, at most MaxCount
+unsigned computePeelCount(Loop *L, unsigned MaxCount)
+{
+    if (MaxCount == 0 || !L->getLoopLatch()) {
+        return 0;
+    }
+
+    DenseMap<PHINode *, unsigned> Cache;
+    unsigned Count = 0;
+    for (BasicBlock::iterator I = L->getHeader()->begin(); isa<PHINode>(I); ++I) {
+        unsigned Iterations = getIterationsToInvariance(cast<PHINode>(I), L, Cache);
+        if (Iterations <= MaxCount) {
+            Count = std::max(Count, Iterations);
+        }
+    }
+
+    if (Count != 0) {
+        DEBUG(dbgs() << "  auto: peel " << Count << " iterations for invariant phis\n");
+    }
+    return Count;
+}
+
+// peels the first PeelCount iterations off L, as straight-line copies of the
+// body in front of it. each copy may still leave the loop. the loop then
+// starts with the values of the last copy, and leaves through an exit block
+// of its own
+//
+//   preheader -> header.peel.begin -> copy 0 -> header.peel.next -> copy 1
+//   -> ... -> header.peel.next -> preheader.peel.newph -> header
+//
+// returns false, without changing the loop, if it is not an innermost loop in
+// simplified form that only exits through its latch
+bool peelLoop(Loop *L, unsigned PeelCount, LoopInfo *LI, DominatorTree *DT,
+              ScalarEvolution *SE, AssumptionCache *AC)
+{
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *PreHeader = L->getLoopPreheader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Exit = L->getUniqueExitBlock();
+
+    if (!L->empty() || !PreHeader || !Latch || !Exit ||
+        L->getExitingBlock() != Latch) {
+        DEBUG(dbgs() << "  no peeling: loop not in simplified form\n");
+        return false;
+    }
+
+    BranchInst *LatchBR = dyn_cast<BranchInst>(Latch->getTerminator());
+    if (!LatchBR || LatchBR->isUnconditional()) {
+        DEBUG(dbgs() << "  no peeling: loop not terminated by a conditional branch\n");
+        return false;
+    }
+
+    DEBUG(dbgs() << "PEELING " << PeelCount << " iterations\n");
+
+    Function *F = Header->getParent();
+
+    // the copies go between two anchor blocks on the preheader edge, and the
+    // loop gets a new preheader
+    BasicBlock *InsertTop = SplitEdge(PreHeader, Header, DT, LI);
+    BasicBlock *InsertBot = SplitBlock(InsertTop, InsertTop->getTerminator(), DT, LI);
+    BasicBlock *NewPreHeader = SplitBlock(InsertBot, InsertBot->getTerminator(), DT, LI);
+    InsertTop->setName(Header->getName() + ".peel.begin");
+    InsertBot->setName(Header->getName() + ".peel.next");
+    NewPreHeader->setName(PreHeader->getName() + ".peel.newph");
+
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+
+    ValueToValueMapTy LastValueMap;
+    for (unsigned Iter = 0; Iter != PeelCount; ++Iter) {
+        clonePeeledIteration(L, Iter, InsertTop, InsertBot, Exit, DFS, LastValueMap, LI, AC);
+
+        InsertTop = InsertBot;
+        InsertBot = SplitBlock(InsertBot, InsertBot->getTerminator(), DT, LI);
+        InsertBot->setName(Header->getName() + ".peel.next");
+    }
+
+    // the loop continues from the last peeled copy
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        Value *InVal = PN->getIncomingValueForBlock(Latch);
+        Instruction *InValI = dyn_cast<Instruction>(InVal);
+        if (InValI && L->contains(InValI->getParent())) {
+            InVal = LastValueMap[InValI];
+        }
+        PN->setIncomingValue(PN->getBasicBlockIndex(NewPreHeader), InVal);
+    }
+
+    DT->recalculate(*F);
+
+    // the copies also leave to Exit, so the loop needs a dedicated exit block
+    // again, with the lcssa phis of the values leaving the latch
+    if (!Exit->getSinglePredecessor()) {
+        SplitBlockPredecessors(Exit, Latch, ".peel.exit", DT, LI, true);
+    }
+
+    SE->forgetLoop(L);
+    if (Loop *ParentLoop = L->getParentLoop()) {
+        SE->forgetLoop(ParentLoop);
+    }
+
+    return true;
+}
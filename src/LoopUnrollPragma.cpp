@@ -0,0 +1,65 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Transforms/Utils/UnrollLoop.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+
+// returns the llvm.loop.unroll.* metadata node named Name of the loop, or null
+MDNode *getUnrollMetadata(Loop *L, StringRef Name)
+{
+    if (MDNode *LoopID = L->getLoopID()) {
+        return GetUnrollMetadata(LoopID, Name);
+    }
+    return nullptr;
+}
+
+// returns the count given by `#pragma clang loop unroll_count(N)`, or zero
+unsigned getUnrollPragmaCount(Loop *L)
+{
+    MDNode *MD = getUnrollMetadata(L, "llvm.loop.unroll.count");
+    if (!MD) {
+        return 0;
+    }
+
+    assert(MD->getNumOperands() == 2 &&
+           "unroll count hint metadata should have two operands.");
+    return mdconst::extract<ConstantInt>(MD->getOperand(1))->getZExtValue();
+}
+
+// replaces the llvm.loop.unroll.* metadata of the loop with
+// llvm.loop.unroll.disable, so that later passes leave it alone
+void setLoopAlreadyUnrolled(Loop *L)
+{
+    MDNode *LoopID = L->getLoopID();
+    LLVMContext &Context = L->getHeader()->getContext();
+
+    // first operand is a reference to the loop id itself, filled in below
+    SmallVector<Metadata *, 4> MDs;
+    MDs.push_back(nullptr);
+
+    // keep all other loop metadata
+    if (LoopID) {
+        for (unsigned i = 1, e = LoopID->getNumOperands(); i < e; ++i) {
+            bool IsUnrollMetadata = false;
+            MDNode *MD = dyn_cast<MDNode>(LoopID->getOperand(i));
+            if (MD) {
+                const MDString *S = dyn_cast<MDString>(MD->getOperand(0));
+                IsUnrollMetadata = S && S->getString().startswith("llvm.loop.unroll.");
+            }
+            if (!IsUnrollMetadata) {
+                MDs.push_back(LoopID->getOperand(i));
+            }
+        }
+    }
+
+    MDs.push_back(MDNode::get(Context, MDString::get(Context, "llvm.loop.unroll.disable")));
+
+    MDNode *NewLoopID = MDNode::get(Context, MDs);
+    NewLoopID->replaceOperandWith(0, NewLoopID);
+    L->setLoopID(NewLoopID);
+}
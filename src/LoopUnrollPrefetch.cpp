@@ -0,0 +1,158 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<unsigned> PrefetchLatency ("my-prefetch-latency", cl::init(200), cl::Hidden,
+                                          cl::desc("Memory latency in cycles that prefetches should hide"));
+
+static cl::opt<unsigned> PrefetchLineSize ("my-prefetch-line-size", cl::init(64), cl::Hidden,
+                                           cl::desc("Cache line size in bytes, if the target does not give one"));
+
+
+// helper functions
+
+// the loads of one array with the same stride: their addresses are at a
+// constant offset from the leader's
+struct PrefetchGroup
+{
+    LoadInst *Leader;
+    int64_t Step;           // bytes per iteration of the unrolled loop
+    int64_t MinOffset;
+    int64_t MaxOffset;      // of the last byte loaded
+};
+
+// returns the number of cycles one iteration of L takes, assuming two
+// instructions per cycle
+static unsigned estimateIterationCycles(Loop *L, LoopInfo *LI)
+{
+    unsigned Insts = 0;
+    for (BasicBlock *BB : L->getBlocks()) {
+        if (LI->getLoopFor(BB) == L) {
+            Insts += BB->size();
+        }
+    }
+    return std::max(1u, Insts / 2);
+}
+
+
+// inserts prefetches for the strided loads of L, which is already unrolled:
+// for each array, one prefetch per cache line that an iteration of L steps
+// over, far enough ahead to hide -my-prefetch-latency cycles. the loads of
+// the unrolled copies are at constant offsets from each other, so their
+// lines are prefetched once, not once per copy. returns the number of
+// prefetches inserted
+unsigned insertPrefetches(Loop *L, LoopInfo *LI, ScalarEvolution *SE,
+                          const TargetTransformInfo &TTI)
+{
+    const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+    unsigned LineSize = TTI.getCacheLineSize();
+    if (LineSize == 0) {
+        LineSize = PrefetchLineSize;
+    }
+
+    // group the loads by array and stride
+    std::vector<PrefetchGroup> Groups;
+    DenseMap<std::pair<const SCEV *, int64_t>, unsigned> GroupIndex;
+    for (BasicBlock *BB : L->getBlocks()) {
+        if (LI->getLoopFor(BB) != L) {
+            continue;
+        }
+
+        for (Instruction &I : *BB) {
+            LoadInst *Load = dyn_cast<LoadInst>(&I);
+            if (!Load || !Load->isSimple()) {
+                continue;
+            }
+
+            const SCEV *Ptr = SE->getSCEV(Load->getPointerOperand());
+            const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(Ptr);
+            if (!AR || AR->getLoop() != L || !AR->isAffine()) {
+                continue;
+            }
+            const SCEVConstant *StepC = dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE));
+            if (!StepC || StepC->getAPInt().getMinSignedBits() > 32 || StepC->isZero()) {
+                continue;
+            }
+            int64_t Step = StepC->getAPInt().getSExtValue();
+            int64_t Size = DL.getTypeStoreSize(Load->getType());
+
+            auto Key = std::make_pair(SE->getPointerBase(Ptr), Step);
+            auto It = GroupIndex.find(Key);
+            if (It == GroupIndex.end()) {
+                GroupIndex[Key] = Groups.size();
+                PrefetchGroup G = { Load, Step, 0, Size - 1 };
+                Groups.push_back(G);
+                continue;
+            }
+
+            PrefetchGroup &G = Groups[It->second];
+            const SCEV *LeaderPtr = SE->getSCEV(G.Leader->getPointerOperand());
+            const SCEVConstant *Diff = dyn_cast<SCEVConstant>(SE->getMinusSCEV(Ptr, LeaderPtr));
+            if (!Diff || Diff->getAPInt().getMinSignedBits() > 32) {
+                continue;
+            }
+            int64_t Offset = Diff->getAPInt().getSExtValue();
+            G.MinOffset = std::min(G.MinOffset, Offset);
+            G.MaxOffset = std::max(G.MaxOffset, Offset + Size - 1);
+        }
+    }
+
+    if (Groups.empty()) {
+        return 0;
+    }
+
+    // the number of iterations the loads are issued ahead
+    unsigned Cycles = estimateIterationCycles(L, LI);
+    int64_t Ahead = (PrefetchLatency + Cycles - 1) / Cycles;
+
+    Module *M = L->getHeader()->getModule();
+    Function *Prefetch = Intrinsic::getDeclaration(M, Intrinsic::prefetch);
+    LLVMContext &Ctx = M->getContext();
+    Type *I8Ptr = Type::getInt8PtrTy(Ctx);
+
+    unsigned Inserted = 0;
+    for (const PrefetchGroup &G : Groups) {
+        // cover what one iteration steps over, at least the bytes it loads
+        int64_t Stride = G.Step < 0 ? -G.Step : G.Step;
+        int64_t Span = std::max(Stride, G.MaxOffset - G.MinOffset + 1);
+        int64_t Lines = (Span + LineSize - 1) / LineSize;
+        int64_t Direction = G.Step < 0 ? -1 : 1;
+        int64_t First = G.Step < 0 ? G.MaxOffset : G.MinOffset;
+
+        IRBuilder<> Builder(G.Leader);
+        Value *Base = Builder.CreateBitCast(G.Leader->getPointerOperand(),
+                                            I8Ptr, "prefetch.base");
+        for (int64_t Line = 0; Line != Lines; ++Line) {
+            int64_t Offset = First + G.Step * Ahead + Direction * Line * LineSize;
+            Value *Addr = Builder.CreateGEP(Base, Builder.getInt64(Offset), "prefetch.addr");
+            // read, high locality, data cache
+            Builder.CreateCall(Prefetch, { Addr, Builder.getInt32(0), Builder.getInt32(3),
+                                           Builder.getInt32(1) });
+            Inserted++;
+        }
+
+        DEBUG(dbgs() << "  prefetch: step = " << G.Step << ", ahead = " << Ahead
+                     << " iterations, lines = " << Lines << "\n");
+    }
+
+    return Inserted;
+}
@@ -0,0 +1,66 @@
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// returns true if the profile has a count for the loop header, in which case
+// Hot is set to whether the profile summary considers that count hot
+bool getLoopHotness(Loop *L, BlockFrequencyInfo *BFI, ProfileSummaryInfo *PSI,
+                    bool &Hot)
+{
+    if (!PSI->hasProfileSummary()) {
+        return false;
+    }
+
+    Optional<uint64_t> HeaderCount = BFI->getBlockProfileCount(L->getHeader());
+    if (!HeaderCount.hasValue()) {
+        return false;
+    }
+
+    DEBUG(dbgs() << "  profile count = " << HeaderCount.getValue() << "\n");
+
+    Hot = PSI->isHotCount(HeaderCount.getValue());
+    return true;
+}
+
+// returns the average trip count of the loop according to the branch weights
+// on its latch, or zero if there are none.
+//
+// each time the loop is entered the latch exits once, so the average trip
+// count is (backedge weight + exit weight) / exit weight
+unsigned getProfileTripCount(Loop *L)
+{
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!Latch || !L->isLoopExiting(Latch)) {
+        return 0;
+    }
+
+    BranchInst *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+    if (!BI || BI->isUnconditional()) {
+        return 0;
+    }
+
+    uint64_t TrueWeight, FalseWeight;
+    if (!BI->extractProfMetadata(TrueWeight, FalseWeight)) {
+        return 0;
+    }
+
+    bool ContinueOnTrue = L->contains(BI->getSuccessor(0));
+    uint64_t BackedgeWeight = ContinueOnTrue ? TrueWeight : FalseWeight;
+    uint64_t ExitWeight = ContinueOnTrue ? FalseWeight : TrueWeight;
+    if (ExitWeight == 0) {
+        return 0;
+    }
+
+    uint64_t TripCount = (BackedgeWeight + ExitWeight + ExitWeight / 2) / ExitWeight;
+    return (unsigned) std::min<uint64_t>(TripCount, UINT_MAX);
+}
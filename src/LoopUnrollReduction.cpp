@@ -0,0 +1,252 @@
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+
+// helper functions
+
+// returns the value that leaves the accumulator of a reduction unchanged, or
+// null if the operation has none. min and max have no such constant, but are
+// idempotent, so their accumulators start at the initial value instead
+static Constant *getReductionIdentity(Instruction *Op)
+{
+    switch (Op->getOpcode()) {
+    case Instruction::FAdd:
+        return ConstantFP::getNegativeZero(Op->getType());
+    case Instruction::FMul:
+        return ConstantFP::get(Op->getType(), 1.0);
+    default:
+        return ConstantExpr::getBinOpIdentity(Op->getOpcode(), Op->getType());
+    }
+}
+
+// returns true if Result is computed from P by a chain of the same
+// associative operation, like x + a[i] + b[i], with P and every intermediate
+// value used only once
+static bool isBinaryReduction(PHINode *P, Instruction *Result, Loop *L)
+{
+    if (!Result->isAssociative() || !Result->isCommutative() ||
+        !getReductionIdentity(Result)) {
+        return false;
+    }
+
+    Instruction *Cur = Result;
+    while (true) {
+        Instruction *Next = nullptr;
+        for (Value *Op : Cur->operands()) {
+            if (Op == P) {
+                return P->hasOneUse();
+            }
+
+            Instruction *OpI = dyn_cast<Instruction>(Op);
+            if (OpI && OpI->getOpcode() == Result->getOpcode() &&
+                OpI->isAssociative() && OpI->hasOneUse() &&
+                L->contains(OpI->getParent())) {
+                if (Next) {
+                    return false;
+                }
+                Next = OpI;
+            }
+        }
+
+        if (!Next) {
+            return false;
+        }
+        Cur = Next;
+    }
+}
+
+// returns true if Result is select(cmp(P, X), P, X) or one of its swapped
+// forms, i.e. a min or max of P. floating point compares must rule out NaNs
+static bool isMinMaxReduction(PHINode *P, Instruction *Result, bool &Swapped)
+{
+    SelectInst *Sel = dyn_cast<SelectInst>(Result);
+    if (!Sel || !P->hasNUses(2)) {
+        return false;
+    }
+
+    CmpInst *Cmp = dyn_cast<CmpInst>(Sel->getCondition());
+    if (!Cmp || !Cmp->hasOneUse() || Cmp->isEquality()) {
+        return false;
+    }
+    if (isa<FCmpInst>(Cmp) && !cast<FPMathOperator>(Cmp)->hasNoNaNs()) {
+        return false;
+    }
+
+    Value *A = Cmp->getOperand(0);
+    Value *B = Cmp->getOperand(1);
+    if (A != P && B != P) {
+        return false;
+    }
+
+    if (Sel->getTrueValue() == A && Sel->getFalseValue() == B) {
+        Swapped = false;
+        return true;
+    }
+    if (Sel->getTrueValue() == B && Sel->getFalseValue() == A) {
+        Swapped = true;
+        return true;
+    }
+    return false;
+}
+
+// combines the values of two accumulators of R before InsertBefore
+static Value *combineReduction(const UnrollReduction &R, Value *A, Value *B,
+                               Instruction *InsertBefore)
+{
+    IRBuilder<> Builder(InsertBefore);
+    StringRef Name = R.Phi->getName();
+
+    if (!R.MinMax) {
+        Value *V = Builder.CreateBinOp((Instruction::BinaryOps) R.Result->getOpcode(),
+                                       A, B, Name + ".red");
+        if (isa<FPMathOperator>(V)) {
+            cast<Instruction>(V)->copyFastMathFlags(R.Result);
+        }
+        return V;
+    }
+
+    CmpInst *Cmp = cast<CmpInst>(cast<SelectInst>(R.Result)->getCondition());
+    Value *C;
+    if (isa<FCmpInst>(Cmp)) {
+        C = Builder.CreateFCmp(Cmp->getPredicate(), A, B, Name + ".red.cmp");
+        cast<Instruction>(C)->copyFastMathFlags(Cmp);
+    } else {
+        C = Builder.CreateICmp(Cmp->getPredicate(), A, B, Name + ".red.cmp");
+    }
+    return R.Swapped ? Builder.CreateSelect(C, B, A, Name + ".red")
+        : Builder.CreateSelect(C, A, B, Name + ".red");
+}
+
+
+// finds the header phis of L that accumulate a reduction: integer add, mul,
+// and, or and xor, floating point add and mul when fast-math allows
+// reassociation, and integer or floating point min and max. the accumulated
+// value may only be used by the next iteration and after the loop
+void findReductions(Loop *L, ArrayRef<PHINode*> HeaderPHIs,
+                    std::vector<UnrollReduction> &Reductions)
+{
+    BasicBlock *Latch = L->getLoopLatch();
+
+    for (PHINode *P : HeaderPHIs) {
+        Instruction *Result = dyn_cast<Instruction>(P->getIncomingValueForBlock(Latch));
+        if (!Result || !L->contains(Result->getParent())) {
+            continue;
+        }
+
+        bool Outside = true;
+        for (User *U : Result->users()) {
+            Instruction *UI = cast<Instruction>(U);
+            if (UI != P && L->contains(UI->getParent())) {
+                Outside = false;
+            }
+        }
+        if (!Outside) {
+            continue;
+        }
+
+        UnrollReduction R;
+        R.Phi = P;
+        R.Result = Result;
+        R.MinMax = false;
+        R.Swapped = false;
+        if (isBinaryReduction(P, Result, L)) {
+            Reductions.push_back(R);
+        } else if (isMinMaxReduction(P, Result, R.Swapped)) {
+            R.MinMax = true;
+            Reductions.push_back(R);
+        }
+    }
+}
+
+// gives each unrolled copy of the loop its own accumulator for R, so that the
+// copies no longer wait for each other. Results[k] is the value of R.Result in
+// copy k. the accumulators are combined in LoopExit, which must only be reached
+// from Latch, the last latch of the unrolled loop
+void splitReduction(const UnrollReduction &R, ArrayRef<Value*> Results,
+                    BasicBlock *Latch, BasicBlock *LoopExit)
+{
+    PHINode *P = R.Phi;
+    BasicBlock *Header = P->getParent();
+    int LatchIdx = P->getBasicBlockIndex(Latch);
+    int EntryIdx = LatchIdx == 0 ? 1 : 0;
+    BasicBlock *Entry = P->getIncomingBlock(EntryIdx);
+    Value *Start = R.MinMax ? P->getIncomingValue(EntryIdx) : getReductionIdentity(R.Result);
+
+    // copy 0 keeps the original accumulator
+    P->setIncomingValue(LatchIdx, Results[0]);
+
+    for (unsigned k = 1; k != Results.size(); ++k) {
+        PHINode *Acc = PHINode::Create(P->getType(), 2, P->getName() + ".acc",
+                                       Header->getFirstNonPHI());
+        Acc->addIncoming(Start, Entry);
+        Acc->addIncoming(Results[k], Latch);
+
+        // the chain of copy k starts from its accumulator instead of the result
+        // of copy k - 1. the header phis keep their incoming values: the
+        // accumulator of copy k - 1 takes Results[k - 1] from the latch
+        Value *Prev = Results[k - 1];
+        SmallVector<Use*, 2> Uses;
+        for (Use &U : Prev->uses()) {
+            Instruction *UI = cast<Instruction>(U.getUser());
+            bool HeaderPHI = isa<PHINode>(UI) && UI->getParent() == Header;
+            if (!HeaderPHI && UI->getParent() != LoopExit) {
+                Uses.push_back(&U);
+            }
+        }
+        for (Use *U : Uses) {
+            U->set(Acc);
+        }
+    }
+
+    // partial results may overflow where the sequential sum did not
+    for (Value *V : Results) {
+        Instruction *Cur = cast<Instruction>(V);
+        while (!R.MinMax && Cur && isa<OverflowingBinaryOperator>(Cur)) {
+            Cur->setHasNoSignedWrap(false);
+            Cur->setHasNoUnsignedWrap(false);
+
+            Instruction *Next = nullptr;
+            for (Value *Op : Cur->operands()) {
+                Instruction *OpI = dyn_cast<Instruction>(Op);
+                if (OpI && !isa<PHINode>(OpI) && OpI->getOpcode() == Cur->getOpcode() &&
+                    OpI->hasOneUse()) {
+                    Next = OpI;
+                }
+            }
+            Cur = Next;
+        }
+    }
+
+    // combine the accumulators after the loop
+    std::vector<PHINode*> ExitPHIs;
+    for (BasicBlock::iterator I = LoopExit->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        if (PN->getIncomingValueForBlock(Latch) == Results.back()) {
+            ExitPHIs.push_back(PN);
+        }
+    }
+    if (ExitPHIs.empty()) {
+        return;
+    }
+
+    Instruction *InsertPt = &*LoopExit->getFirstInsertionPt();
+    Value *Combined = nullptr;
+    for (Value *V : Results) {
+        PHINode *LCSSA = PHINode::Create(P->getType(), 1, V->getName() + ".lcssa",
+                                         &LoopExit->front());
+        LCSSA->addIncoming(V, Latch);
+        Combined = Combined ? combineReduction(R, Combined, LCSSA, InsertPt) : LCSSA;
+    }
+
+    for (PHINode *PN : ExitPHIs) {
+        PN->replaceAllUsesWith(Combined);
+        PN->eraseFromParent();
+    }
+}
@@ -0,0 +1,268 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/UnrollLoop.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// helper functions
+
+// returns the value V has at the end of the cloned loop, if V is defined in L
+static Value *getClonedValue(Value *V, const Loop *L, ValueToValueMapTy &VMap)
+{
+    if (Instruction *I = dyn_cast<Instruction>(V)) {
+        if (L->contains(I->getParent())) {
+            return VMap[I];
+        }
+    }
+    return V;
+}
+
+// inserts a prolog loop in front of L, which executes the first
+// (TripCount % Count) iterations. the remaining trip count of L is then a
+// multiple of Count, so the unrolled loop only needs to test the exit
+// condition once per unrolled iteration.
+//
+// the resulting layout is:
+//
+//   preheader:       xtraiter = TripCount % Count
+//                    br (xtraiter != 0), prol.preheader, prol.loopexit
+//   prol.preheader:  br prol.header
+//   prol.*:          clone of L, running xtraiter iterations
+//   prol.unr-lcssa:  lcssa phis of the prolog
+//   prol.loopexit:   br (TripCount < Count), exit.split, preheader.new
+//   preheader.new:   br header
+//   header ... latch (L, unrolled by the caller)
+//   exit:            lcssa phis of L
+//   exit.split:      merge of both paths into the original exit
+//
+// returns false, without changing the loop, if the trip count cannot be
+// computed in the preheader or the loop is not in the expected form.
+bool unrollRuntimeLoopProlog(Loop *L, unsigned Count, LoopInfo *LI,
+                             DominatorTree *DT, ScalarEvolution *SE)
+{
+    BasicBlock *PreHeader = L->getLoopPreheader();
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+
+    // only innermost loops in simplified form, exiting through the latch
+    if (!L->empty() || !PreHeader || !Latch) {
+        DEBUG(dbgs() << "  no runtime prolog: loop not in simplified form\n");
+        return false;
+    }
+    if (L->getExitingBlock() != Latch) {
+        DEBUG(dbgs() << "  no runtime prolog: loop has more than one exit\n");
+        return false;
+    }
+
+    BranchInst *LatchBR = cast<BranchInst>(Latch->getTerminator());
+    bool ContinueOnTrue = L->contains(LatchBR->getSuccessor(0));
+    BasicBlock *LatchExit = LatchBR->getSuccessor(ContinueOnTrue);
+    if (LatchExit->getSinglePredecessor() != Latch) {
+        DEBUG(dbgs() << "  no runtime prolog: exit block is not dedicated\n");
+        return false;
+    }
+
+    // the trip count must be computable in the preheader
+    const SCEV *BECountSC = SE->getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(BECountSC) ||
+        !BECountSC->getType()->isIntegerTy()) {
+        DEBUG(dbgs() << "  no runtime prolog: cannot compute trip count\n");
+        return false;
+    }
+
+    Type *Ty = BECountSC->getType();
+    if (!isUIntN(Ty->getIntegerBitWidth(), Count)) {
+        DEBUG(dbgs() << "  no runtime prolog: count does not fit in the trip count type\n");
+        return false;
+    }
+
+    // may wrap to zero if the backedge-taken count is the maximum value, in
+    // which case the remainder is computed from BECount below
+    const SCEV *TripCountSC = SE->getAddExpr(BECountSC, SE->getConstant(Ty, 1));
+
+    const DataLayout &DL = Header->getModule()->getDataLayout();
+    SCEVExpander Expander(*SE, DL, "loop-unroll");
+    if (!isSafeToExpand(TripCountSC, *SE) ||
+        Expander.isHighCostExpansion(TripCountSC, L)) {
+        DEBUG(dbgs() << "  no runtime prolog: trip count too expensive to compute\n");
+        return false;
+    }
+
+    Function *F = Header->getParent();
+    LLVMContext &Ctx = F->getContext();
+    Loop *ParentLoop = L->getParentLoop();
+
+    // keep a dedicated exit for L, and join with the prolog-only path below it
+    BasicBlock *Merge = SplitBlock(LatchExit, LatchExit->getFirstNonPHI(), DT, LI);
+
+    // compute the number of extra iterations in the preheader
+    BranchInst *PreHeaderBR = cast<BranchInst>(PreHeader->getTerminator());
+    Value *BECount = Expander.expandCodeFor(BECountSC, Ty, PreHeaderBR);
+    Value *TripCount = Expander.expandCodeFor(TripCountSC, Ty, PreHeaderBR);
+
+    IRBuilder<> B(PreHeaderBR);
+    Value *ModVal;
+    if (isPowerOf2_32(Count)) {
+        // a wrapped trip count is still a multiple of any power of two
+        ModVal = B.CreateAnd(TripCount, Count - 1, "xtraiter");
+    } else {
+        // ((BECount % Count) + 1) % Count, as TripCount may have wrapped
+        Value *CountV = ConstantInt::get(Ty, Count);
+        Value *ModBE = B.CreateURem(BECount, CountV);
+        Value *ModAdd = B.CreateAdd(ModBE, ConstantInt::get(Ty, 1));
+        ModVal = B.CreateURem(ModAdd, CountV, "xtraiter");
+    }
+    Value *HasProlog = B.CreateIsNotNull(ModVal, "lcmp.mod");
+
+    // create the blocks surrounding the prolog
+    BasicBlock *PrologPreHeader =
+        BasicBlock::Create(Ctx, Header->getName() + ".prol.preheader", F, Header);
+
+    // clone the loop body, in RPO so the header of the clone comes first
+    ValueToValueMapTy VMap;
+    NewLoopsMap NewLoops;
+    if (ParentLoop) {
+        NewLoops[ParentLoop] = ParentLoop;
+    }
+
+    std::vector<BasicBlock*> NewBlocks;
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+    for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+        BasicBlock *New = CloneBasicBlock(*BB, VMap, ".prol");
+        F->getBasicBlockList().insert(Header->getIterator(), New);
+        VMap[*BB] = New;
+        addClonedBlockToLoopInfo(*BB, New, LI, NewLoops);
+        NewBlocks.push_back(New);
+    }
+
+    for (BasicBlock *NewBlock : NewBlocks) {
+        for (Instruction &I : *NewBlock) {
+            remapInstruction(&I, VMap);
+        }
+    }
+
+    BasicBlock *PrologHeader = cast<BasicBlock>(VMap[Header]);
+    BasicBlock *PrologLatch = cast<BasicBlock>(VMap[Latch]);
+
+    BasicBlock *PrologUnrExit =
+        BasicBlock::Create(Ctx, Header->getName() + ".prol.loopexit.unr-lcssa", F, Header);
+    BasicBlock *PrologExit =
+        BasicBlock::Create(Ctx, Header->getName() + ".prol.loopexit", F, Header);
+    BasicBlock *NewPreHeader =
+        BasicBlock::Create(Ctx, PreHeader->getName() + ".new", F, Header);
+
+    // the prolog is entered from its own preheader
+    for (BasicBlock::iterator I = PrologHeader->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        PN->setIncomingBlock(PN->getBasicBlockIndex(PreHeader), PrologPreHeader);
+    }
+
+    // the prolog counts down the extra iterations instead of testing the
+    // original exit condition
+    PHINode *PrologIter = PHINode::Create(Ty, 2, "prol.iter", &PrologHeader->front());
+    IRBuilder<> PB(PrologLatch->getTerminator());
+    Value *PrologIterSub = PB.CreateSub(PrologIter, ConstantInt::get(Ty, 1), "prol.iter.sub");
+    Value *PrologIterCmp = PB.CreateIsNotNull(PrologIterSub, "prol.iter.cmp");
+    PrologIter->addIncoming(ModVal, PrologPreHeader);
+    PrologIter->addIncoming(PrologIterSub, PrologLatch);
+
+    BranchInst *PrologBR = cast<BranchInst>(PrologLatch->getTerminator());
+    Value *PrologCond = PrologBR->getCondition();
+    BranchInst::Create(PrologHeader, PrologUnrExit, PrologIterCmp, PrologLatch);
+    PrologBR->eraseFromParent();
+    RecursivelyDeleteTriviallyDeadInstructions(PrologCond);
+
+    // the loop continues with the values at the end of the prolog, or the
+    // initial values if the prolog was skipped
+    for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        int Idx = PN->getBasicBlockIndex(PreHeader);
+        Value *InitVal = PN->getIncomingValue(Idx);
+        Value *PrologVal = getClonedValue(PN->getIncomingValueForBlock(Latch), L, VMap);
+
+        PHINode *LCSSA = PHINode::Create(PN->getType(), 1,
+                                         PN->getName() + ".unr-lcssa", PrologUnrExit);
+        LCSSA->addIncoming(PrologVal, PrologLatch);
+
+        PHINode *Unr = PHINode::Create(PN->getType(), 2,
+                                       PN->getName() + ".unr", PrologExit);
+        Unr->addIncoming(InitVal, PreHeader);
+        Unr->addIncoming(LCSSA, PrologUnrExit);
+
+        PN->setIncomingBlock(Idx, NewPreHeader);
+        PN->setIncomingValue(Idx, Unr);
+    }
+
+    // values live after the loop come from either L or the prolog. the
+    // prolog can only reach the exit if it was entered, so the value on the
+    // edge that skips it is never used
+    for (BasicBlock::iterator I = LatchExit->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        Value *PrologVal = getClonedValue(PN->getIncomingValueForBlock(Latch), L, VMap);
+
+        PHINode *LCSSA = PHINode::Create(PN->getType(), 1,
+                                         PN->getName() + ".unr-lcssa", PrologUnrExit);
+        LCSSA->addIncoming(PrologVal, PrologLatch);
+
+        PHINode *Unr = PHINode::Create(PN->getType(), 2,
+                                       PN->getName() + ".unr", PrologExit);
+        Unr->addIncoming(UndefValue::get(PN->getType()), PreHeader);
+        Unr->addIncoming(LCSSA, PrologUnrExit);
+
+        PHINode *MergePN = PHINode::Create(PN->getType(), 2,
+                                           PN->getName() + ".merge", &Merge->front());
+        PN->replaceAllUsesWith(MergePN);
+        MergePN->addIncoming(PN, LatchExit);
+        MergePN->addIncoming(Unr, PrologExit);
+    }
+
+    // connect the new blocks
+    BranchInst::Create(PrologHeader, PrologPreHeader);
+    BranchInst::Create(PrologExit, PrologUnrExit);
+    BranchInst::Create(Header, NewPreHeader);
+
+    // skip the unrolled loop if the prolog already ran all iterations
+    IRBuilder<> EB(PrologExit);
+    Value *SkipUnrolled = EB.CreateICmpULT(BECount, ConstantInt::get(Ty, Count - 1),
+                                           "prol.skip");
+    EB.CreateCondBr(SkipUnrolled, Merge, NewPreHeader);
+
+    BranchInst::Create(PrologPreHeader, PrologExit, HasProlog, PreHeader);
+    PreHeaderBR->eraseFromParent();
+
+    // update analyses
+    if (ParentLoop) {
+        ParentLoop->addBasicBlockToLoop(PrologPreHeader, *LI);
+        ParentLoop->addBasicBlockToLoop(PrologUnrExit, *LI);
+        ParentLoop->addBasicBlockToLoop(PrologExit, *LI);
+        ParentLoop->addBasicBlockToLoop(NewPreHeader, *LI);
+    }
+
+    // the prolog never runs more than Count - 1 iterations
+    setLoopAlreadyUnrolled(NewLoops[L]);
+
+    if (DT) {
+        DT->recalculate(*F);
+    }
+
+    SE->forgetLoop(L);
+
+    return true;
+}
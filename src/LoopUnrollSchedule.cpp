@@ -0,0 +1,261 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<unsigned> ScheduleWidth ("my-unroll-schedule-width", cl::init(2), cl::Hidden,
+                                        cl::desc("Instructions issued per cycle by the scheduler of unrolled blocks"));
+
+static cl::opt<unsigned> ScheduleLoadLatency ("my-unroll-schedule-load-latency", cl::init(4), cl::Hidden,
+                                              cl::desc("Cycles from a load to its first use, for the scheduler of unrolled blocks"));
+
+static cl::opt<unsigned> ScheduleMaxSize ("my-unroll-schedule-max-size", cl::init(1000), cl::Hidden,
+                                          cl::desc("Largest block the scheduler of unrolled blocks reorders"));
+
+
+// helper functions
+
+// an instruction of the block being scheduled
+struct ScheduleNode
+{
+    Instruction *Inst;
+    unsigned Latency;
+    unsigned Height;                // longest latency path to the end of the block
+    unsigned NumPreds;              // not yet scheduled
+    SmallVector<unsigned, 4> Succs;
+    SmallVector<unsigned, 4> Preds;
+};
+
+// returns the cycles until the result of I can be used. arithmetic costs come
+// from the target, loads from -my-unroll-schedule-load-latency
+static unsigned getLatency(Instruction *I, const TargetTransformInfo &TTI)
+{
+    if (isa<LoadInst>(I)) {
+        return ScheduleLoadLatency;
+    }
+    if (I->isBinaryOp()) {
+        return std::max(1, TTI.getArithmeticInstrCost(I->getOpcode(), I->getType()));
+    }
+    return TTI.getUserCost(I) == TargetTransformInfo::TCC_Free ? 0 : 1;
+}
+
+// returns true if the memory accesses of A and B must stay in order
+static bool isMemoryDependent(Instruction *A, Instruction *B, AliasAnalysis *AA)
+{
+    if (!A->mayWriteToMemory() && !B->mayWriteToMemory()) {
+        return false;
+    }
+
+    bool SimpleA = (isa<LoadInst>(A) && cast<LoadInst>(A)->isSimple()) ||
+        (isa<StoreInst>(A) && cast<StoreInst>(A)->isSimple());
+    bool SimpleB = (isa<LoadInst>(B) && cast<LoadInst>(B)->isSimple()) ||
+        (isa<StoreInst>(B) && cast<StoreInst>(B)->isSimple());
+    if (!SimpleA || !SimpleB) {
+        return true;
+    }
+
+    return AA->alias(MemoryLocation::get(A), MemoryLocation::get(B)) != NoAlias;
+}
+
+// returns the cycles an in-order core of -my-unroll-schedule-width takes to
+// issue the nodes in Order
+static unsigned simulateInOrder(ArrayRef<unsigned> Order,
+                                const std::vector<ScheduleNode> &Nodes)
+{
+    std::vector<unsigned> Ready(Nodes.size(), 0);
+    unsigned Cycle = 0, Issued = 0, End = 0;
+
+    for (unsigned N : Order) {
+        if (Ready[N] > Cycle) {
+            Cycle = Ready[N];
+            Issued = 0;
+        }
+        if (Issued == ScheduleWidth) {
+            Cycle++;
+            Issued = 0;
+        }
+        Issued++;
+
+        unsigned Done = Cycle + Nodes[N].Latency;
+        End = std::max(End, Done);
+        for (unsigned S : Nodes[N].Succs) {
+            Ready[S] = std::max(Ready[S], Done);
+        }
+    }
+
+    return std::max(End, Cycle + 1);
+}
+
+
+// reorders the instructions of BB, a straight-line block of unrolled copies,
+// so that independent instructions of different copies are interleaved. a
+// list scheduler issues -my-unroll-schedule-width instructions per cycle,
+// taking the ready one on the longest latency path first, so the loads of a
+// later copy start before the arithmetic of the earlier one. def-use and
+// memory dependences keep their order. the new order is kept only if it is
+// faster on an in-order core. returns true if BB was changed
+bool scheduleUnrolledBlock(BasicBlock *BB, AliasAnalysis *AA,
+                           const TargetTransformInfo &TTI)
+{
+    // phis stay at the top and the terminator at the bottom
+    std::vector<ScheduleNode> Nodes;
+    DenseMap<Instruction *, unsigned> Index;
+    for (Instruction &I : *BB) {
+        if (isa<PHINode>(I) || &I == BB->getTerminator()) {
+            continue;
+        }
+        if (I.isEHPad()) {
+            return false;
+        }
+
+        ScheduleNode N;
+        N.Inst = &I;
+        N.Latency = getLatency(&I, TTI);
+        N.Height = 0;
+        N.NumPreds = 0;
+        Index[&I] = Nodes.size();
+        Nodes.push_back(N);
+    }
+
+    if (Nodes.size() < 2 || Nodes.size() > ScheduleMaxSize) {
+        return false;
+    }
+
+    auto AddEdge = [&](unsigned From, unsigned To) {
+        Nodes[From].Succs.push_back(To);
+        Nodes[To].Preds.push_back(From);
+        Nodes[To].NumPreds++;
+    };
+
+    // def-use edges, and the memory order. instructions that may trap or
+    // fault stay behind the side effects before them, which may throw or not
+    // return
+    std::vector<unsigned> Memory, SideEffects;
+    for (unsigned n = 0; n != Nodes.size(); ++n) {
+        Instruction *I = Nodes[n].Inst;
+        for (Value *Op : I->operands()) {
+            auto It = Index.find(dyn_cast<Instruction>(Op));
+            if (It != Index.end()) {
+                AddEdge(It->second, n);
+            }
+        }
+
+        if (!isSafeToSpeculativelyExecute(I)) {
+            for (unsigned m : SideEffects) {
+                AddEdge(m, n);
+            }
+        }
+        if (I->mayHaveSideEffects()) {
+            SideEffects.push_back(n);
+        }
+
+        if (I->mayReadOrWriteMemory() || I->mayHaveSideEffects()) {
+            for (unsigned m : Memory) {
+                if (I->mayHaveSideEffects() && Nodes[m].Inst->mayHaveSideEffects()) {
+                    AddEdge(m, n);
+                } else if (isMemoryDependent(Nodes[m].Inst, I, AA)) {
+                    AddEdge(m, n);
+                }
+            }
+            Memory.push_back(n);
+        }
+    }
+
+    // heights, bottom up
+    for (unsigned n = Nodes.size(); n-- != 0; ) {
+        unsigned Height = 0;
+        for (unsigned S : Nodes[n].Succs) {
+            Height = std::max(Height, Nodes[S].Height);
+        }
+        Nodes[n].Height = Height + Nodes[n].Latency;
+    }
+
+    // list scheduling
+    std::vector<unsigned> Order;
+    std::vector<unsigned> Ready(Nodes.size(), 0);
+    std::vector<unsigned> Available;
+    for (unsigned n = 0; n != Nodes.size(); ++n) {
+        if (Nodes[n].NumPreds == 0) {
+            Available.push_back(n);
+        }
+    }
+
+    unsigned Cycle = 0, Issued = 0;
+    while (!Available.empty()) {
+        // the highest node that is ready this cycle, else the one ready first
+        unsigned Best = 0;
+        for (unsigned a = 1; a != Available.size(); ++a) {
+            const ScheduleNode &N = Nodes[Available[a]];
+            const ScheduleNode &B = Nodes[Available[Best]];
+            bool NReady = Ready[Available[a]] <= Cycle;
+            bool BReady = Ready[Available[Best]] <= Cycle;
+            if (NReady != BReady) {
+                if (NReady) {
+                    Best = a;
+                }
+            } else if (!NReady && Ready[Available[a]] != Ready[Available[Best]]) {
+                if (Ready[Available[a]] < Ready[Available[Best]]) {
+                    Best = a;
+                }
+            } else if (N.Height > B.Height) {
+                Best = a;
+            }
+        }
+
+        unsigned n = Available[Best];
+        Available.erase(Available.begin() + Best);
+
+        if (Ready[n] > Cycle) {
+            Cycle = Ready[n];
+            Issued = 0;
+        }
+        if (Issued == ScheduleWidth) {
+            Cycle++;
+            Issued = 0;
+        }
+        Issued++;
+        Order.push_back(n);
+
+        for (unsigned S : Nodes[n].Succs) {
+            Ready[S] = std::max(Ready[S], Cycle + Nodes[n].Latency);
+            if (--Nodes[S].NumPreds == 0) {
+                Available.push_back(S);
+            }
+        }
+    }
+
+    std::vector<unsigned> Original(Nodes.size());
+    for (unsigned n = 0; n != Nodes.size(); ++n) {
+        Original[n] = n;
+    }
+    unsigned Before = simulateInOrder(Original, Nodes);
+    unsigned After = simulateInOrder(Order, Nodes);
+    if (After >= Before) {
+        return false;
+    }
+
+    Instruction *Term = BB->getTerminator();
+    for (unsigned n : Order) {
+        Nodes[n].Inst->moveBefore(Term);
+    }
+
+    DEBUG(dbgs() << "  scheduled " << Nodes.size() << " instructions in "
+                 << BB->getName() << ": " << Before << " -> " << After << " cycles\n");
+    return true;
+}
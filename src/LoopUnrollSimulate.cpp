@@ -0,0 +1,212 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+
+// command line options
+
+static cl::opt<unsigned> UnrollMaxIterationsToAnalyze ("my-unroll-max-iterations-to-analyze", cl::init(1000), cl::Hidden,
+                                                       cl::desc("Largest trip count for which the completely unrolled size is simulated"));
+
+
+// helper functions
+
+typedef DenseMap<Value *, Constant *> ConstantMap;
+
+// returns V as a constant, if it is one or was folded in this iteration
+static Constant *getConstant(Value *V, const ConstantMap &Values)
+{
+    if (Constant *C = dyn_cast<Constant>(V)) {
+        return C;
+    }
+    auto It = Values.find(V);
+    return It != Values.end() ? It->second : nullptr;
+}
+
+// folds I to a constant, given the constant values in Values, or returns null.
+// loads fold if they read a constant global at a constant address
+static Constant *foldInstruction(Instruction *I, const ConstantMap &Values,
+                                 const DataLayout &DL)
+{
+    if (I->mayHaveSideEffects() || isa<TerminatorInst>(I)) {
+        return nullptr;
+    }
+
+    SmallVector<Constant *, 4> Ops;
+    for (Value *Op : I->operands()) {
+        Constant *C = getConstant(Op, Values);
+        if (!C) {
+            return nullptr;
+        }
+        Ops.push_back(C);
+    }
+
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        if (!LI->isSimple()) {
+            return nullptr;
+        }
+        return ConstantFoldLoadFromConstPtr(Ops[0], LI->getType(), DL);
+    }
+    if (CmpInst *Cmp = dyn_cast<CmpInst>(I)) {
+        return ConstantFoldCompareInstOperands(Cmp->getPredicate(), Ops[0], Ops[1], DL);
+    }
+    return ConstantFoldInstOperands(I, Ops, DL);
+}
+
+// returns the successor that the terminator of BB takes, or null if it is
+// not known
+static BasicBlock *getTakenSuccessor(BasicBlock *BB, const ConstantMap &Values)
+{
+    TerminatorInst *T = BB->getTerminator();
+    if (BranchInst *BI = dyn_cast<BranchInst>(T)) {
+        if (BI->isUnconditional()) {
+            return BI->getSuccessor(0);
+        }
+        if (ConstantInt *C = dyn_cast_or_null<ConstantInt>(getConstant(BI->getCondition(), Values))) {
+            return BI->getSuccessor(C->isZero() ? 1 : 0);
+        }
+    } else if (SwitchInst *SI = dyn_cast<SwitchInst>(T)) {
+        if (ConstantInt *C = dyn_cast_or_null<ConstantInt>(getConstant(SI->getCondition(), Values))) {
+            return SI->findCaseValue(C).getCaseSuccessor();
+        }
+    }
+    return nullptr;
+}
+
+
+// estimates the size of L after complete unrolling and simplification, by
+// walking its TripCount iterations with the header phis set to the constants
+// they take in each of them. instructions whose operands are all constant
+// fold away, and only the blocks reached through branches on known
+// conditions are counted. returns false if L cannot be simulated, or as soon
+// as the size is over Threshold
+bool estimateUnrolledSize(Loop *L, unsigned TripCount, unsigned Threshold,
+                          LoopInfo *LI, const TargetTransformInfo &TTI,
+                          unsigned &UnrolledSize)
+{
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!L->empty() || !Latch || !Preheader || TripCount == 0 ||
+        TripCount > UnrollMaxIterationsToAnalyze) {
+        return false;
+    }
+
+    const DataLayout &DL = Header->getModule()->getDataLayout();
+
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+
+    unsigned Size = 0;
+    ConstantMap Prev;
+    for (unsigned Iter = 0; Iter != TripCount; ++Iter) {
+        ConstantMap Values;
+
+        // the header phis take the initial values, or those of the previous
+        // iteration
+        for (BasicBlock::iterator I = Header->begin(); isa<PHINode>(I); ++I) {
+            PHINode *PN = cast<PHINode>(I);
+            Value *In = Iter == 0 ? PN->getIncomingValueForBlock(Preheader)
+                : PN->getIncomingValueForBlock(Latch);
+            if (Constant *C = getConstant(In, Iter == 0 ? Values : Prev)) {
+                Values[PN] = C;
+            }
+        }
+
+        // the edges taken in this iteration
+        SmallPtrSet<BasicBlock *, 16> Reached;
+        DenseMap<BasicBlock *, SmallPtrSet<BasicBlock *, 2> > Edges;
+        Reached.insert(Header);
+        bool Continues = false;
+
+        for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+            if (!Reached.count(*BB)) {
+                continue;
+            }
+
+            for (Instruction &I : **BB) {
+                if (isa<PHINode>(I)) {
+                    if (*BB == Header) {
+                        continue;
+                    }
+
+                    // a phi is constant if all edges taken into it bring the
+                    // same constant
+                    PHINode *PN = cast<PHINode>(&I);
+                    Constant *Same = nullptr;
+                    bool Folds = true;
+                    for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+                        if (!Edges[PN->getIncomingBlock(i)].count(*BB)) {
+                            continue;
+                        }
+                        Constant *C = getConstant(PN->getIncomingValue(i), Values);
+                        if (!C || (Same && Same != C)) {
+                            Folds = false;
+                            break;
+                        }
+                        Same = C;
+                    }
+                    if (Folds && Same) {
+                        Values[PN] = Same;
+                    }
+                    continue;
+                }
+
+                if (isa<TerminatorInst>(I)) {
+                    continue;
+                }
+
+                if (Constant *C = foldInstruction(&I, Values, DL)) {
+                    Values[&I] = C;
+                } else {
+                    Size += TTI.getUserCost(&I);
+                }
+            }
+
+            // branches on known conditions disappear, the others remain
+            BasicBlock *Taken = getTakenSuccessor(*BB, Values);
+            TerminatorInst *T = (*BB)->getTerminator();
+            if (!Taken) {
+                Size += TTI.getUserCost(T);
+            }
+            for (unsigned i = 0, e = T->getNumSuccessors(); i != e; ++i) {
+                BasicBlock *Succ = T->getSuccessor(i);
+                if (Taken && Succ != Taken) {
+                    continue;
+                }
+                if (Succ == Header) {
+                    Continues = true;
+                } else if (L->contains(Succ)) {
+                    Reached.insert(Succ);
+                    Edges[*BB].insert(Succ);
+                }
+            }
+        }
+
+        if (Size > Threshold) {
+            return false;
+        }
+
+        // a known exit ends the unrolled code early
+        if (!Continues) {
+            break;
+        }
+
+        Prev = std::move(Values);
+    }
+
+    UnrolledSize = Size;
+    return true;
+}
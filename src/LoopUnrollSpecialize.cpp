@@ -0,0 +1,308 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll-specialize"
+
+STATISTIC(NumSpecialized, "Number of specialized clones");
+STATISTIC(NumCallsRedirected, "Number of calls redirected to a specialized clone");
+
+
+// command line options
+
+static cl::opt<unsigned> SpecializeMaxClones ("my-specialize-max-clones", cl::init(4), cl::Hidden,
+                                              cl::desc("Largest number of specialized clones per function"));
+
+static cl::opt<unsigned> SpecializeThreshold ("my-specialize-threshold", cl::init(0), cl::Hidden,
+                                              cl::desc("The cut-off point for unrolling the loops of a specialized clone"));
+
+
+// helper functions
+
+// collects the arguments a trip count expression is made of. Other is set if
+// it also depends on values that are not arguments
+struct ArgumentCollector
+{
+    SmallVector<unsigned, 4> ArgNos;
+    bool Other = false;
+
+    bool follow(const SCEV *S)
+    {
+        if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+            Argument *A = dyn_cast<Argument>(U->getValue());
+            if (!A || !A->getType()->isIntegerTy()) {
+                Other = true;
+            } else if (std::find(ArgNos.begin(), ArgNos.end(), A->getArgNo()) == ArgNos.end()) {
+                ArgNos.push_back(A->getArgNo());
+            }
+        }
+        return true;
+    }
+
+    bool isDone() const { return Other; }
+};
+
+// the analyses of one function. they are built here, not taken from
+// getAnalysis: for a module pass, each getAnalysis call on a function reruns
+// all on-the-fly function passes, which frees the results of the earlier calls
+struct FunctionAnalyses
+{
+    DominatorTree DT;
+    LoopInfo LI;
+    ScalarEvolution SE;
+
+    FunctionAnalyses(Function &F, TargetLibraryInfo &TLI, AssumptionCache &AC)
+        : DT(F), LI(DT), SE(F, TLI, AC, DT, LI) {}
+};
+
+// the constants of a group of call sites, one per trip count argument
+struct SpecializeCandidate
+{
+    SmallVector<ConstantInt*, 4> Values;
+    SmallVector<CallSite, 4> Calls;
+    uint64_t Weight;
+};
+
+// returns the numbers of the arguments that, if constant, make the trip
+// count of some loop of F constant. the loops whose trip counts depend on
+// anything else are not counted
+static SmallVector<unsigned, 4> getTripCountArguments(LoopInfo *LI, ScalarEvolution *SE)
+{
+    SmallVector<unsigned, 4> ArgNos;
+    SmallVector<Loop*, 8> Worklist(LI->begin(), LI->end());
+
+    while (!Worklist.empty()) {
+        Loop *L = Worklist.pop_back_val();
+        Worklist.append(L->begin(), L->end());
+
+        const SCEV *BackedgeTakenCount = SE->getBackedgeTakenCount(L);
+        if (isa<SCEVCouldNotCompute>(BackedgeTakenCount) ||
+            isa<SCEVConstant>(BackedgeTakenCount)) {
+            continue;
+        }
+
+        ArgumentCollector Collector;
+        SCEVTraversal<ArgumentCollector> Traversal(Collector);
+        Traversal.visitAll(BackedgeTakenCount);
+        if (Collector.Other) {
+            continue;
+        }
+
+        for (unsigned ArgNo : Collector.ArgNos) {
+            if (std::find(ArgNos.begin(), ArgNos.end(), ArgNo) == ArgNos.end()) {
+                ArgNos.push_back(ArgNo);
+            }
+        }
+    }
+
+    std::sort(ArgNos.begin(), ArgNos.end());
+    return ArgNos;
+}
+
+// collects the loops of a function, inner loops before their parents
+static void collectLoopsInnerFirst(Loop *L, SmallVectorImpl<Loop*> &Loops)
+{
+    for (Loop *SubLoop : *L) {
+        collectLoopsInnerFirst(SubLoop, Loops);
+    }
+    Loops.push_back(L);
+}
+
+// unrolls the loops of a specialized clone whose trip counts became
+// constant. returns the number of loops unrolled
+static unsigned unrollSpecializedLoops(Function *F, LoopInfo *LI, DominatorTree *DT,
+                                       ScalarEvolution *SE, AssumptionCache *AC,
+                                       AliasAnalysis *AA, const TargetTransformInfo &TTI,
+                                       OptimizationRemarkEmitter *ORE)
+{
+    SmallVector<Loop*, 8> Loops;
+    for (Loop *L : *LI) {
+        collectLoopsInnerFirst(L, Loops);
+    }
+
+    unsigned Unrolled = 0;
+    for (Loop *L : Loops) {
+        if (SE->getSmallConstantTripCount(L) == 0 ||
+            getUnrollMetadata(L, "llvm.loop.unroll.disable")) {
+            continue;
+        }
+
+        DEBUG(dbgs() << "Loop Unroll: F[" << F->getName()
+                     << "] L%" << L->getHeader()->getName() << "\n");
+
+        // the loop pass manager would have prepared the loop
+        simplifyLoop(L, DT, LI, SE, AC, true);
+        formLCSSARecursively(*L, *DT, LI, SE);
+
+        if (!unrollLoop(L, 0, SpecializeThreshold, false, 0, LI, DT, SE, AC, AA, TTI, ORE)) {
+            continue;
+        }
+
+        if (L->getNumBackEdges() != 0) {
+            setLoopAlreadyUnrolled(L);
+        } else {
+            SE->forgetLoop(L);
+            LI->markAsRemoved(L);
+        }
+        Unrolled++;
+
+        DEBUG(dbgs() << "finished\n");
+    }
+
+    return Unrolled;
+}
+
+
+// class functions
+
+char LoopUnrollSpecialize::ID = 0;
+
+// finds the calls that pass constants to the arguments the trip counts of
+// a function depend on. the most frequent constants, weighted by the
+// profile count of the calls if there is one, get a clone of the function
+// with the arguments replaced by them, at most -my-specialize-max-clones
+// per function. the calls are redirected to the clone, and the loops of
+// the clone, whose trip counts are now known, are unrolled
+bool LoopUnrollSpecialize::runOnModule(Module &M)
+{
+    std::vector<Function*> Functions;
+    for (Function &F : M) {
+        if (!F.isDeclaration() && !F.isVarArg() && isSelectedFunction(F.getName())) {
+            Functions.push_back(&F);
+        }
+    }
+
+    TargetLibraryInfo &TLI = getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
+    AssumptionCacheTracker &ACT = getAnalysis<AssumptionCacheTracker>();
+
+    bool Changed = false;
+    for (Function *F : Functions) {
+        SmallVector<unsigned, 4> ArgNos;
+        {
+            FunctionAnalyses FA(*F, TLI, ACT.getAssumptionCache(*F));
+            if (FA.LI.empty()) {
+                continue;
+            }
+            ArgNos = getTripCountArguments(&FA.LI, &FA.SE);
+        }
+        if (ArgNos.empty()) {
+            continue;
+        }
+
+        DEBUG(dbgs() << "Specialize: F[" << F->getName() << "]\n");
+
+        // group the direct calls by their constant arguments
+        std::vector<SpecializeCandidate> Candidates;
+        for (Use &U : F->uses()) {
+            CallSite CS(U.getUser());
+            if (!CS || !CS.isCallee(&U) || CS.getCaller() == F) {
+                continue;
+            }
+
+            SmallVector<ConstantInt*, 4> Values;
+            for (unsigned ArgNo : ArgNos) {
+                ConstantInt *C = dyn_cast<ConstantInt>(CS.getArgument(ArgNo));
+                if (!C) {
+                    break;
+                }
+                Values.push_back(C);
+            }
+            if (Values.size() != ArgNos.size()) {
+                continue;
+            }
+
+            // BFI is only valid until the next getAnalysis call
+            BlockFrequencyInfo *BFI =
+                &getAnalysis<BlockFrequencyInfoWrapperPass>(*CS.getCaller()).getBFI();
+            Optional<uint64_t> Count = BFI->getBlockProfileCount(CS.getInstruction()->getParent());
+            uint64_t Weight = Count.hasValue() ? *Count : 1;
+
+            auto It = std::find_if(Candidates.begin(), Candidates.end(),
+                                   [&](const SpecializeCandidate &C) { return C.Values == Values; });
+            if (It == Candidates.end()) {
+                SpecializeCandidate C = { Values, {}, 0 };
+                Candidates.push_back(C);
+                It = Candidates.end() - 1;
+            }
+            It->Calls.push_back(CS);
+            It->Weight += Weight;
+        }
+
+        if (Candidates.empty()) {
+            DEBUG(dbgs() << "skipping: no calls with constant trip count arguments\n");
+            continue;
+        }
+
+        std::stable_sort(Candidates.begin(), Candidates.end(),
+                         [](const SpecializeCandidate &A, const SpecializeCandidate &B) {
+                             return A.Weight > B.Weight;
+                         });
+        if (Candidates.size() > SpecializeMaxClones) {
+            DEBUG(dbgs() << "  " << Candidates.size() - SpecializeMaxClones
+                         << " constant sets over the clone limit\n");
+            Candidates.resize(SpecializeMaxClones);
+        }
+
+        for (const SpecializeCandidate &C : Candidates) {
+            std::string Name = F->getName().str();
+            for (ConstantInt *V : C.Values) {
+                Name += "." + V->getValue().toString(10, true);
+            }
+
+            ValueToValueMapTy VMap;
+            Function *Clone = CloneFunction(F, VMap);
+            Clone->setName(Name);
+            Clone->setLinkage(GlobalValue::InternalLinkage);
+            for (unsigned i = 0; i != ArgNos.size(); ++i) {
+                Argument *A = &*std::next(Clone->arg_begin(), ArgNos[i]);
+                A->replaceAllUsesWith(C.Values[i]);
+            }
+
+            for (CallSite CS : C.Calls) {
+                CS.setCalledFunction(Clone);
+            }
+            NumSpecialized++;
+            NumCallsRedirected += C.Calls.size();
+
+            DEBUG(dbgs() << "  clone " << Clone->getName() << ": calls = " << C.Calls.size()
+                         << ", weight = " << C.Weight << "\n");
+
+            AssumptionCache &AC = ACT.getAssumptionCache(*Clone);
+            FunctionAnalyses FA(*Clone, TLI, AC);
+            BasicAAResult BasicAA(M.getDataLayout(), TLI, AC, &FA.DT, &FA.LI);
+            AAResults AA(TLI);
+            AA.addAAResult(BasicAA);
+            OptimizationRemarkEmitter ORE(Clone, nullptr);
+            const TargetTransformInfo &TTI =
+                getAnalysis<TargetTransformInfoWrapperPass>().getTTI(*Clone);
+
+            unrollSpecializedLoops(Clone, &FA.LI, &FA.DT, &FA.SE, &AC, &AA, TTI, &ORE);
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
@@ -0,0 +1,235 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// helper functions
+
+static Value *getAccessPointer(Instruction *I)
+{
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        return LI->getPointerOperand();
+    }
+    return cast<StoreInst>(I)->getPointerOperand();
+}
+
+static uint64_t getAccessSize(Instruction *I, const DataLayout &DL)
+{
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        return DL.getTypeStoreSize(LI->getType());
+    }
+    return DL.getTypeStoreSize(cast<StoreInst>(I)->getValueOperand()->getType());
+}
+
+static bool isSimpleAccess(Instruction *I)
+{
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        return LI->isSimple();
+    }
+    if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+        return SI->isSimple();
+    }
+    return false;
+}
+
+// returns true if the memory accessed by A and B is known to be disjoint,
+// either at a constant distance from each other or in different objects
+static bool isNoAlias(Instruction *A, Instruction *B, ScalarEvolution *SE,
+                      const DataLayout &DL)
+{
+    const SCEV *PA = SE->getSCEV(getAccessPointer(A));
+    const SCEV *PB = SE->getSCEV(getAccessPointer(B));
+
+    const SCEV *Diff = SE->getMinusSCEV(PA, PB);
+    if (const SCEVConstant *C = dyn_cast<SCEVConstant>(Diff)) {
+        int64_t D = C->getAPInt().getSExtValue();
+        return D >= (int64_t) getAccessSize(B, DL) || -D >= (int64_t) getAccessSize(A, DL);
+    }
+
+    const SCEVUnknown *BaseA = dyn_cast<SCEVUnknown>(SE->getPointerBase(PA));
+    const SCEVUnknown *BaseB = dyn_cast<SCEVUnknown>(SE->getPointerBase(PB));
+    return BaseA && BaseB && BaseA != BaseB &&
+        isIdentifiedObject(BaseA->getValue()) && isIdentifiedObject(BaseB->getValue());
+}
+
+// returns true if Mem can move across I
+static bool canMoveAcross(Instruction *Mem, Instruction *I, ScalarEvolution *SE,
+                          const DataLayout &DL)
+{
+    if (!I->mayReadOrWriteMemory()) {
+        return true;
+    }
+    if (!isSimpleAccess(I)) {
+        return false;
+    }
+    if (!I->mayWriteToMemory() && !Mem->mayWriteToMemory()) {
+        return true;
+    }
+    return isNoAlias(Mem, I, SE, DL);
+}
+
+// collects the instructions in Between that I needs for its address, in an
+// order where operands come first. returns false if one of them cannot move
+static bool collectAddress(Instruction *I, SmallPtrSetImpl<Instruction *> &Between,
+                           SmallSetVector<Instruction *, 8> &ToMove)
+{
+    for (Value *Op : I->operands()) {
+        Instruction *OpI = dyn_cast<Instruction>(Op);
+        if (!OpI || !Between.count(OpI) || ToMove.count(OpI)) {
+            continue;
+        }
+        if (OpI->mayReadOrWriteMemory() || OpI->mayHaveSideEffects()) {
+            return false;
+        }
+        if (!collectAddress(OpI, Between, ToMove)) {
+            return false;
+        }
+        ToMove.insert(OpI);
+    }
+    return true;
+}
+
+// moves Load, and the computation of its address, to just after Prev
+static bool hoistLoadAfter(Instruction *Load, Instruction *Prev, ScalarEvolution *SE,
+                           const DataLayout &DL)
+{
+    SmallPtrSet<Instruction *, 16> Between;
+    for (Instruction *I = Prev->getNextNode(); I != Load; I = I->getNextNode()) {
+        if (!canMoveAcross(Load, I, SE, DL)) {
+            return false;
+        }
+        Between.insert(I);
+    }
+
+    SmallSetVector<Instruction *, 8> ToMove;
+    if (!collectAddress(Load, Between, ToMove)) {
+        return false;
+    }
+    ToMove.insert(Load);
+
+    Instruction *InsertPt = Prev->getNextNode();
+    for (Instruction *I : ToMove) {
+        I->moveBefore(InsertPt);
+    }
+    return true;
+}
+
+// moves Store to just before Next. its operands are defined before it, so
+// only the memory accesses in between matter
+static bool sinkStoreBefore(Instruction *Store, Instruction *Next, ScalarEvolution *SE,
+                            const DataLayout &DL)
+{
+    for (Instruction *I = Store->getNextNode(); I != Next; I = I->getNextNode()) {
+        if (!canMoveAcross(Store, I, SE, DL)) {
+            return false;
+        }
+    }
+
+    Store->moveBefore(Next);
+    return true;
+}
+
+
+// returns the unroll factor that fills a vector register with the elements of
+// a simple strided array loop, or zero if L is not one. such a loop is a single
+// block without calls, whose loads and stores all step through memory one
+// element per iteration
+unsigned getVectorUnrollFactor(Loop *L, ScalarEvolution *SE,
+                               const TargetTransformInfo &TTI)
+{
+    unsigned RegisterBits = TTI.getRegisterBitWidth(true);
+    if (RegisterBits == 0 || L->getNumBlocks() != 1) {
+        return 0;
+    }
+
+    const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+    uint64_t MinSize = 0;
+    for (Instruction &I : *L->getHeader()) {
+        if (!I.mayReadOrWriteMemory()) {
+            continue;
+        }
+        if (!isSimpleAccess(&I)) {
+            return 0;
+        }
+
+        const SCEVAddRecExpr *AR =
+            dyn_cast<SCEVAddRecExpr>(SE->getSCEV(getAccessPointer(&I)));
+        if (!AR || AR->getLoop() != L) {
+            return 0;
+        }
+
+        const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE));
+        uint64_t Size = getAccessSize(&I, DL);
+        if (!Step || Step->getAPInt() != Size) {
+            return 0;
+        }
+
+        MinSize = MinSize == 0 ? Size : std::min(MinSize, Size);
+    }
+
+    if (MinSize == 0 || RegisterBits / 8 <= MinSize) {
+        return 0;
+    }
+    return RegisterBits / 8 / MinSize;
+}
+
+// reorders the loads and stores of the unrolled copies in BB so that the ones
+// to adjacent addresses of the same array form contiguous runs, which the SLP
+// vectorizer turns into vector loads and stores. loads move up next to the
+// previous load of their array, stores down next to the following store.
+// accesses are never moved across memory they may alias
+void groupMemoryAccesses(BasicBlock *BB, ScalarEvolution *SE)
+{
+    const DataLayout &DL = BB->getModule()->getDataLayout();
+
+    std::vector<Instruction *> Loads, Stores;
+    for (Instruction &I : *BB) {
+        if (isa<LoadInst>(I) && isSimpleAccess(&I)) {
+            Loads.push_back(&I);
+        } else if (isa<StoreInst>(I) && isSimpleAccess(&I)) {
+            Stores.push_back(&I);
+        }
+    }
+
+    unsigned Moved = 0;
+
+    DenseMap<const SCEV *, Instruction *> LastLoad;
+    for (Instruction *Load : Loads) {
+        const SCEV *Base = SE->getPointerBase(SE->getSCEV(getAccessPointer(Load)));
+        Instruction *&Prev = LastLoad[Base];
+        if (Prev && Prev->getNextNode() != Load && hoistLoadAfter(Load, Prev, SE, DL)) {
+            Moved++;
+        }
+        Prev = Load;
+    }
+
+    DenseMap<const SCEV *, Instruction *> NextStore;
+    for (auto It = Stores.rbegin(); It != Stores.rend(); ++It) {
+        Instruction *Store = *It;
+        const SCEV *Base = SE->getPointerBase(SE->getSCEV(getAccessPointer(Store)));
+        Instruction *&Next = NextStore[Base];
+        if (Next && Store->getNextNode() != Next && sinkStoreBefore(Store, Next, SE, DL)) {
+            Moved++;
+        }
+        Next = Store;
+    }
+
+    if (Moved != 0) {
+        DEBUG(dbgs() << "  grouped " << Moved << " memory accesses\n");
+    }
+}
@@ -0,0 +1,402 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/UnrollLoop.h"
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-unroll"
+
+
+// command line options
+
+static cl::opt<unsigned> VersionMaxChecks ("my-unroll-version-max-checks", cl::init(4), cl::Hidden,
+                                           cl::desc("Largest number of pointer pairs checked for overlap by a versioned loop"));
+
+
+// helper functions
+
+// the accesses of L to one array, all at affine addresses. Low and High
+// bound the bytes they touch over all iterations
+struct VersionGroup
+{
+    const SCEV *Base;
+    std::vector<Instruction *> Accesses;
+    bool Writes;
+    const SCEV *Low;
+    const SCEV *High;
+};
+
+static Value *getAccessPointer(Instruction *I)
+{
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        return LI->getPointerOperand();
+    }
+    return cast<StoreInst>(I)->getPointerOperand();
+}
+
+// returns the loop invariant value the step of AR is a multiple of, like s in
+// a[i * s], or null if the step is constant
+static Value *getSymbolicStride(const SCEVAddRecExpr *AR, ScalarEvolution *SE)
+{
+    const SCEV *Step = AR->getStepRecurrence(*SE);
+    if (const SCEVMulExpr *Mul = dyn_cast<SCEVMulExpr>(Step)) {
+        if (Mul->getNumOperands() != 2 || !isa<SCEVConstant>(Mul->getOperand(0))) {
+            return nullptr;
+        }
+        Step = Mul->getOperand(1);
+    }
+    if (const SCEVCastExpr *Cast = dyn_cast<SCEVCastExpr>(Step)) {
+        Step = Cast->getOperand();
+    }
+    if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(Step)) {
+        if (U->getType()->isIntegerTy()) {
+            return U->getValue();
+        }
+    }
+    return nullptr;
+}
+
+// groups the simple loads and stores of L by array. returns false if one of
+// them is not at an affine address
+static bool collectGroups(Loop *L, const SCEV *BECount, ScalarEvolution *SE,
+                          std::vector<VersionGroup> &Groups,
+                          SmallPtrSetImpl<Value *> &Strides)
+{
+    const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+    DenseMap<const SCEV *, unsigned> GroupIndex;
+
+    for (BasicBlock *BB : L->getBlocks()) {
+        for (Instruction &I : *BB) {
+            if (!I.mayReadOrWriteMemory()) {
+                continue;
+            }
+            if (!isa<LoadInst>(I) && !isa<StoreInst>(I)) {
+                return false;
+            }
+
+            const SCEV *Ptr = SE->getSCEV(getAccessPointer(&I));
+            const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(Ptr);
+            if (!AR || AR->getLoop() != L || !AR->isAffine()) {
+                return false;
+            }
+            if (Value *Stride = getSymbolicStride(AR, SE)) {
+                Strides.insert(Stride);
+            }
+
+            Type *Ty = isa<LoadInst>(I) ? I.getType()
+                : cast<StoreInst>(I).getValueOperand()->getType();
+            const SCEV *Size = SE->getConstant(DL.getIntPtrType(I.getContext()),
+                                               DL.getTypeStoreSize(Ty));
+            const SCEV *First = AR->getStart();
+            const SCEV *Last = AR->evaluateAtIteration(BECount, *SE);
+            const SCEV *Low = SE->getUMinExpr(First, Last);
+            const SCEV *High = SE->getAddExpr(SE->getUMaxExpr(First, Last), Size);
+
+            const SCEV *Base = SE->getPointerBase(Ptr);
+            auto It = GroupIndex.find(Base);
+            if (It == GroupIndex.end()) {
+                GroupIndex[Base] = Groups.size();
+                VersionGroup G = { Base, {}, false, Low, High };
+                Groups.push_back(G);
+                It = GroupIndex.find(Base);
+            }
+
+            VersionGroup &G = Groups[It->second];
+            G.Accesses.push_back(&I);
+            G.Writes |= isa<StoreInst>(I);
+            G.Low = SE->getUMinExpr(G.Low, Low);
+            G.High = SE->getUMaxExpr(G.High, High);
+        }
+    }
+
+    return true;
+}
+
+// returns true if the arrays of A and B are known to be different objects
+static bool isDistinctObject(const VersionGroup &A, const VersionGroup &B)
+{
+    const SCEVUnknown *BaseA = dyn_cast<SCEVUnknown>(A.Base);
+    const SCEVUnknown *BaseB = dyn_cast<SCEVUnknown>(B.Base);
+    return BaseA && BaseB && isIdentifiedObject(BaseA->getValue()) &&
+        isIdentifiedObject(BaseB->getValue());
+}
+
+// marks the accesses of the checked groups as not aliasing each other, which
+// holds in the versioned loop only
+static void addNoAliasScopes(ArrayRef<const VersionGroup *> Checked, LLVMContext &Ctx)
+{
+    MDBuilder MDB(Ctx);
+    MDNode *Domain = MDB.createAnonymousAliasScopeDomain("version");
+
+    std::vector<MDNode *> Scopes;
+    for (unsigned g = 0; g != Checked.size(); ++g) {
+        Scopes.push_back(MDB.createAnonymousAliasScope(Domain));
+    }
+
+    for (unsigned g = 0; g != Checked.size(); ++g) {
+        SmallVector<Metadata *, 4> Others;
+        for (unsigned o = 0; o != Checked.size(); ++o) {
+            if (o != g) {
+                Others.push_back(Scopes[o]);
+            }
+        }
+
+        MDNode *Scope = MDNode::get(Ctx, Scopes[g]);
+        MDNode *NoAlias = MDNode::get(Ctx, Others);
+        for (Instruction *I : Checked[g]->Accesses) {
+            I->setMetadata(LLVMContext::MD_alias_scope,
+                           MDNode::concatenate(I->getMetadata(LLVMContext::MD_alias_scope), Scope));
+            I->setMetadata(LLVMContext::MD_noalias,
+                           MDNode::concatenate(I->getMetadata(LLVMContext::MD_noalias), NoAlias));
+        }
+    }
+}
+
+
+// versions L for unrolling by Count: L is only entered if a run-time guard in
+// the preheader holds, and a copy of the original loop runs otherwise. the
+// guard checks that
+//   - the trip count is a multiple of Count, if CheckTripMultiple is set and
+//     Count fits the type of the trip count, else CheckTripMultiple is reset,
+//   - symbolic strides are one, which then become constant in L, and
+//   - the arrays written in L do not overlap the other arrays it accesses,
+//     which L then tells alias analysis through scoped noalias metadata.
+//
+//   preheader:          guard
+//                       br guard, preheader.split, header.fallback.ph
+//   preheader.split:    br header
+//   header ... latch:   L, unrolled by the caller
+//   exit:               lcssa phis of L
+//   header.fallback.ph  br header.fallback
+//   *.fallback:         the original loop and its exit block
+//   exit.split:         merge of both loops into the original exit
+//
+// returns false, without changing the loop, if no guard is needed or L is not
+// in the expected form. the caller may only rely on the trip count multiple
+// if CheckTripMultiple is still set when versionLoop returns true
+bool versionLoop(Loop *L, unsigned Count, bool &CheckTripMultiple, LoopInfo *LI,
+                 DominatorTree *DT, ScalarEvolution *SE)
+{
+    BasicBlock *PreHeader = L->getLoopPreheader();
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+
+    // only innermost loops in simplified form, exiting through the latch
+    if (!L->empty() || !PreHeader || !Latch || L->getExitingBlock() != Latch) {
+        DEBUG(dbgs() << "  no versioning: loop not in simplified form\n");
+        return false;
+    }
+
+    BranchInst *LatchBR = cast<BranchInst>(Latch->getTerminator());
+    BasicBlock *LatchExit = LatchBR->getSuccessor(L->contains(LatchBR->getSuccessor(0)));
+    if (LatchExit->getSinglePredecessor() != Latch) {
+        DEBUG(dbgs() << "  no versioning: exit block is not dedicated\n");
+        return false;
+    }
+
+    const SCEV *BECountSC = SE->getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(BECountSC) || !BECountSC->getType()->isIntegerTy()) {
+        DEBUG(dbgs() << "  no versioning: cannot compute trip count\n");
+        return false;
+    }
+    Type *Ty = BECountSC->getType();
+    if (!isUIntN(Ty->getIntegerBitWidth(), Count)) {
+        CheckTripMultiple = false;
+    }
+
+    // what to check at run time
+    std::vector<VersionGroup> Groups;
+    SmallPtrSet<Value *, 2> Strides;
+    std::vector<std::pair<const VersionGroup *, const VersionGroup *> > Overlaps;
+    if (collectGroups(L, BECountSC, SE, Groups, Strides)) {
+        for (unsigned a = 0; a != Groups.size(); ++a) {
+            for (unsigned b = a + 1; b != Groups.size(); ++b) {
+                if ((Groups[a].Writes || Groups[b].Writes) &&
+                    !isDistinctObject(Groups[a], Groups[b])) {
+                    Overlaps.push_back(std::make_pair(&Groups[a], &Groups[b]));
+                }
+            }
+        }
+        if (Overlaps.size() > VersionMaxChecks) {
+            DEBUG(dbgs() << "  versioning: too many pointer pairs to check ("
+                         << Overlaps.size() << ")\n");
+            Overlaps.clear();
+        }
+    } else {
+        Strides.clear();
+    }
+
+    if (!CheckTripMultiple && Strides.empty() && Overlaps.empty()) {
+        DEBUG(dbgs() << "  no versioning: nothing to check\n");
+        return false;
+    }
+
+    const DataLayout &DL = Header->getModule()->getDataLayout();
+    SCEVExpander Expander(*SE, DL, "loop-version");
+    for (auto &Pair : Overlaps) {
+        if (!isSafeToExpand(Pair.first->Low, *SE) || !isSafeToExpand(Pair.first->High, *SE) ||
+            !isSafeToExpand(Pair.second->Low, *SE) || !isSafeToExpand(Pair.second->High, *SE)) {
+            DEBUG(dbgs() << "  no versioning: cannot compute array bounds\n");
+            return false;
+        }
+    }
+    if (CheckTripMultiple && !isSafeToExpand(BECountSC, *SE)) {
+        DEBUG(dbgs() << "  no versioning: cannot compute trip count\n");
+        return false;
+    }
+
+    Function *F = Header->getParent();
+    LLVMContext &Ctx = F->getContext();
+    Loop *ParentLoop = L->getParentLoop();
+
+    // the guard
+    BranchInst *PreHeaderBR = cast<BranchInst>(PreHeader->getTerminator());
+    IRBuilder<> B(PreHeaderBR);
+    Value *Guard = B.getTrue();
+
+    if (CheckTripMultiple) {
+        // ((BECount % Count) + 1) % Count == 0, as the trip count may wrap
+        Value *BECount = Expander.expandCodeFor(BECountSC, Ty, PreHeaderBR);
+        Value *CountV = ConstantInt::get(Ty, Count);
+        Value *ModBE = B.CreateURem(BECount, CountV);
+        Value *ModAdd = B.CreateAdd(ModBE, ConstantInt::get(Ty, 1));
+        Value *Mod = B.CreateURem(ModAdd, CountV, "version.mod");
+        Guard = B.CreateAnd(B.CreateIsNull(Mod, "version.multiple"), Guard);
+        DEBUG(dbgs() << "  versioning: trip count multiple of " << Count << "\n");
+    }
+
+    for (Value *Stride : Strides) {
+        Value *IsOne = B.CreateICmpEQ(Stride, ConstantInt::get(Stride->getType(), 1),
+                                      "version.stride");
+        Guard = B.CreateAnd(IsOne, Guard);
+        DEBUG(dbgs() << "  versioning: stride " << Stride->getName() << " = 1\n");
+    }
+
+    Type *IntPtrTy = DL.getIntPtrType(Ctx);
+    SmallPtrSet<const VersionGroup *, 4> CheckedSet;
+    std::vector<const VersionGroup *> Checked;
+    for (auto &Pair : Overlaps) {
+        Value *LowA = Expander.expandCodeFor(Pair.first->Low, IntPtrTy, PreHeaderBR);
+        Value *HighA = Expander.expandCodeFor(Pair.first->High, IntPtrTy, PreHeaderBR);
+        Value *LowB = Expander.expandCodeFor(Pair.second->Low, IntPtrTy, PreHeaderBR);
+        Value *HighB = Expander.expandCodeFor(Pair.second->High, IntPtrTy, PreHeaderBR);
+        Value *Disjoint = B.CreateOr(B.CreateICmpULE(HighA, LowB), B.CreateICmpULE(HighB, LowA),
+                                     "version.disjoint");
+        Guard = B.CreateAnd(Disjoint, Guard);
+
+        for (const VersionGroup *G : { Pair.first, Pair.second }) {
+            if (CheckedSet.insert(G).second) {
+                Checked.push_back(G);
+            }
+        }
+    }
+    if (!Overlaps.empty()) {
+        DEBUG(dbgs() << "  versioning: " << Overlaps.size() << " pointer pairs do not overlap\n");
+    }
+
+    // keep a dedicated exit for L, and join with the fallback below it
+    BasicBlock *Merge = SplitBlock(LatchExit, LatchExit->getFirstNonPHI(), DT, LI);
+    BasicBlock *FastPreHeader = SplitBlock(PreHeader, PreHeaderBR, DT, LI);
+    BasicBlock *FallbackPreHeader =
+        BasicBlock::Create(Ctx, Header->getName() + ".fallback.ph", F, Merge);
+
+    // clone the loop and its exit, in RPO so the header of the clone comes first
+    ValueToValueMapTy VMap;
+    NewLoopsMap NewLoops;
+    if (ParentLoop) {
+        NewLoops[ParentLoop] = ParentLoop;
+    }
+
+    std::vector<BasicBlock*> NewBlocks;
+    LoopBlocksDFS DFS(L);
+    DFS.perform(LI);
+    for (LoopBlocksDFS::RPOIterator BB = DFS.beginRPO(); BB != DFS.endRPO(); ++BB) {
+        BasicBlock *New = CloneBasicBlock(*BB, VMap, ".fallback");
+        F->getBasicBlockList().insert(Merge->getIterator(), New);
+        VMap[*BB] = New;
+        addClonedBlockToLoopInfo(*BB, New, LI, NewLoops);
+        NewBlocks.push_back(New);
+    }
+
+    BasicBlock *FallbackExit = CloneBasicBlock(LatchExit, VMap, ".fallback");
+    F->getBasicBlockList().insert(Merge->getIterator(), FallbackExit);
+    VMap[LatchExit] = FallbackExit;
+    NewBlocks.push_back(FallbackExit);
+
+    for (BasicBlock *NewBlock : NewBlocks) {
+        for (Instruction &I : *NewBlock) {
+            remapInstruction(&I, VMap);
+        }
+    }
+
+    // the fallback is entered from its own preheader
+    BasicBlock *FallbackHeader = cast<BasicBlock>(VMap[Header]);
+    for (BasicBlock::iterator I = FallbackHeader->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        PN->setIncomingBlock(PN->getBasicBlockIndex(FastPreHeader), FallbackPreHeader);
+    }
+    BranchInst::Create(FallbackHeader, FallbackPreHeader);
+
+    // values live after the loop come from either loop
+    for (BasicBlock::iterator I = LatchExit->begin(); isa<PHINode>(I); ++I) {
+        PHINode *PN = cast<PHINode>(I);
+        PHINode *MergePN = PHINode::Create(PN->getType(), 2,
+                                           PN->getName() + ".merge", &Merge->front());
+        PN->replaceAllUsesWith(MergePN);
+        MergePN->addIncoming(PN, LatchExit);
+        MergePN->addIncoming(VMap[PN], FallbackExit);
+    }
+
+    TerminatorInst *PreHeaderTerm = PreHeader->getTerminator();
+    BranchInst::Create(FastPreHeader, FallbackPreHeader, Guard, PreHeader);
+    PreHeaderTerm->eraseFromParent();
+
+    // the guard holds in L: strides are one and the arrays are disjoint
+    for (Value *Stride : Strides) {
+        Constant *One = ConstantInt::get(Stride->getType(), 1);
+        for (auto UI = Stride->use_begin(), UE = Stride->use_end(); UI != UE; ) {
+            Use &U = *UI++;
+            Instruction *User = dyn_cast<Instruction>(U.getUser());
+            if (User && L->contains(User->getParent())) {
+                U.set(One);
+            }
+        }
+    }
+    if (!Checked.empty()) {
+        addNoAliasScopes(Checked, Ctx);
+    }
+
+    // update analyses
+    if (ParentLoop) {
+        ParentLoop->addBasicBlockToLoop(FallbackPreHeader, *LI);
+        ParentLoop->addBasicBlockToLoop(FallbackExit, *LI);
+    }
+
+    // the fallback is the loop as it was
+    setLoopAlreadyUnrolled(NewLoops[L]);
+
+    if (DT) {
+        DT->recalculate(*F);
+    }
+
+    SE->forgetLoop(L);
+
+    return true;
+}
@@ -0,0 +1,257 @@
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LCSSA.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "LoopUnroll.h"
+
+using namespace llvm;
+
+// builds the unrolled variants of a program for a range of unroll counts in
+// one process. the -base.ll module is parsed once, and each worker thread
+// reads it into its own LLVMContext, then clones it for every count it
+// takes, runs the unroll pass and code generation, and writes the assembly
+// to <prefix>-<count>.s (or the IR to <prefix>-<count>.ll with -emit-llvm)
+
+
+// command line options
+
+static cl::opt<std::string> InputFilename (cl::Positional, cl::Required,
+                                           cl::desc("<base module>"));
+
+static cl::opt<std::string> OutputPrefix ("o", cl::init(""),
+                                          cl::desc("Prefix of the output files, by default the input without -base.ll and with -opt"));
+
+static cl::opt<unsigned> FirstCount ("first-count", cl::init(1),
+                                     cl::desc("Smallest unroll count to build"));
+
+static cl::opt<unsigned> LastCount ("last-count", cl::init(100),
+                                    cl::desc("Largest unroll count to build"));
+
+static cl::opt<unsigned> Threads ("j", cl::init(0),
+                                  cl::desc("Number of worker threads, by default one per core"));
+
+static cl::opt<bool> EmitLLVM ("emit-llvm", cl::init(false),
+                               cl::desc("Write the unrolled IR instead of assembly"));
+
+static cl::opt<bool> NewPM ("new-pm", cl::init(false),
+                            cl::desc("Unroll with the new pass manager"));
+
+
+// helper functions
+
+// serializes the output of the workers
+static std::mutex OutputMutex;
+
+static void reportError(const Twine &Message)
+{
+    std::lock_guard<std::mutex> Lock(OutputMutex);
+    errs() << "unroll-driver: " << Message << "\n";
+}
+
+// returns the output prefix for the input file name
+static std::string getOutputPrefix()
+{
+    if (!OutputPrefix.empty()) {
+        return OutputPrefix;
+    }
+
+    StringRef Name = InputFilename;
+    if (Name.endswith(".ll")) {
+        Name = Name.drop_back(3);
+    }
+    if (Name.endswith("-base")) {
+        Name = Name.drop_back(5);
+    }
+    return Name.str() + "-opt";
+}
+
+// unrolls the loops of M with NewLoopUnroll. the remark emitter is computed
+// up front, as loop passes only read function analyses from the cache
+static void runNewPM(Module &M, unsigned Count, TargetMachine &TM)
+{
+    PassBuilder PB(&TM);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    FunctionPassManager FPM;
+    FPM.addPass(LoopSimplifyPass());
+    FPM.addPass(LCSSAPass());
+    FPM.addPass(RequireAnalysisPass<OptimizationRemarkEmitterAnalysis, Function>());
+    FPM.addPass(createFunctionToLoopPassAdaptor(NewLoopUnroll(Count)));
+    FPM.addPass(VerifierPass());
+
+    ModulePassManager MPM;
+    MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+    MPM.run(M, MAM);
+}
+
+// unrolls a clone of Base with Count and writes it out. returns false on
+// errors
+static bool buildVariant(const Module &Base, unsigned Count, TargetMachine &TM,
+                         const std::string &Prefix)
+{
+    std::unique_ptr<Module> M = CloneModule(&Base);
+
+    if (NewPM) {
+        runNewPM(*M, Count, TM);
+    } else {
+        legacy::PassManager UnrollPM;
+        UnrollPM.add(createTargetTransformInfoWrapperPass(TM.getTargetIRAnalysis()));
+        UnrollPM.add(new LoopUnroll(Count));
+        UnrollPM.add(createVerifierPass());
+        UnrollPM.run(*M);
+    }
+
+    std::string Path = Prefix + "-" + std::to_string(Count) + (EmitLLVM ? ".ll" : ".s");
+    std::error_code EC;
+    raw_fd_ostream Out(Path, EC, sys::fs::F_Text);
+    if (EC) {
+        reportError("cannot open '" + Path + "': " + EC.message());
+        return false;
+    }
+
+    if (EmitLLVM) {
+        M->print(Out, nullptr);
+        return true;
+    }
+
+    legacy::PassManager CodeGenPM;
+    CodeGenPM.add(new TargetLibraryInfoWrapperPass(Triple(M->getTargetTriple())));
+    if (TM.addPassesToEmitFile(CodeGenPM, Out, TargetMachine::CGFT_AssemblyFile)) {
+        reportError("target cannot emit assembly");
+        return false;
+    }
+    CodeGenPM.run(*M);
+
+    return true;
+}
+
+// the loop of one worker: reads the module into a context of its own and
+// builds the counts it takes from Next until all are done
+static void runWorker(StringRef Bitcode, std::atomic<unsigned> &Next,
+                      std::atomic<bool> &Failed, const std::string &Prefix)
+{
+    LLVMContext Context;
+    Expected<std::unique_ptr<Module>> BaseOrErr =
+        parseBitcodeFile(MemoryBufferRef(Bitcode, InputFilename), Context);
+    if (!BaseOrErr) {
+        reportError(toString(BaseOrErr.takeError()));
+        Failed = true;
+        return;
+    }
+    std::unique_ptr<Module> Base = std::move(*BaseOrErr);
+
+    std::string Error;
+    std::string TripleName = Base->getTargetTriple().empty()
+        ? sys::getDefaultTargetTriple() : Base->getTargetTriple();
+    const Target *T = TargetRegistry::lookupTarget(TripleName, Error);
+    if (!T) {
+        reportError(Error);
+        Failed = true;
+        return;
+    }
+    std::unique_ptr<TargetMachine> TM(T->createTargetMachine(TripleName, "", "", TargetOptions(),
+                                                             Optional<Reloc::Model>()));
+
+    for (unsigned Count = Next++; Count <= LastCount && !Failed; Count = Next++) {
+        if (!buildVariant(*Base, Count, *TM, Prefix)) {
+            Failed = true;
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    llvm_shutdown_obj Shutdown;
+
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmPrinters();
+
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeCore(Registry);
+    initializeAnalysis(Registry);
+    initializeTransformUtils(Registry);
+    initializeScalarOpts(Registry);
+    initializeCodeGen(Registry);
+    initializeTarget(Registry);
+
+    cl::ParseCommandLineOptions(argc, argv, "builds the unrolled variants of a module\n");
+
+    if (FirstCount == 0 || FirstCount > LastCount) {
+        errs() << argv[0] << ": invalid count range\n";
+        return 1;
+    }
+
+    // parse once. the workers read the bitcode, which is much faster than
+    // parsing the text again
+    LLVMContext Context;
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Context);
+    if (!M) {
+        Err.print(argv[0], errs());
+        return 1;
+    }
+
+    SmallString<0> Bitcode;
+    raw_svector_ostream OS(Bitcode);
+    WriteBitcodeToFile(M.get(), OS);
+    M.reset();
+
+    unsigned NumCounts = LastCount - FirstCount + 1;
+    unsigned NumThreads = Threads > 0 ? Threads : std::thread::hardware_concurrency();
+    NumThreads = std::max(1u, std::min(NumThreads, NumCounts));
+
+    std::string Prefix = getOutputPrefix();
+    std::atomic<unsigned> Next(FirstCount);
+    std::atomic<bool> Failed(false);
+
+    ThreadPool Pool(NumThreads);
+    for (unsigned i = 0; i != NumThreads; ++i) {
+        Pool.async([&]() { runWorker(Bitcode, Next, Failed, Prefix); });
+    }
+    Pool.wait();
+
+    if (Failed) {
+        return 1;
+    }
+
+    errs() << "built " << NumCounts << " variants with " << NumThreads << " threads\n";
+    return 0;
+}
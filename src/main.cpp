@@ -5,3 +5,4 @@
 using namespace llvm;
 
 static RegisterPass<LoopUnroll> X("my-loop-unroll", "My loop unroll pass", false, false);
+static RegisterPass<LoopUnrollSpecialize> Y("my-loop-unroll-specialize", "My call site specialization and loop unroll pass", false, false);
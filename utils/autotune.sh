@@ -0,0 +1,151 @@
+#!/bin/bash
+
+# finds the fastest unroll count for each loop of a program by measurement,
+# and stores it in a database that later builds read with -my-unroll-db.
+# loops are tuned one at a time, inner loops first: the counts of the loops
+# tuned before stay in place while the next one is searched. counts are
+# tried as powers of two until -s tries in a row were not faster, then the
+# counts halfway to the neighbours of the best one are tried
+
+iter=1000
+count=64
+stop=2
+db="unroll.db"
+prog=""
+
+# builds the optimized program with the database in $1 and prints its median
+# time, or nothing if it failed or its result is wrong
+measure() {
+    rm -f ${prog_opt}.ll ${prog_opt}.s ${prog_opt}.out
+    if ! err=$(make ${prog_opt}.out PROG=${prog} PASSCOUNT=0 PASSFLAGS="-my-unroll-db=$1" 2>&1)
+    then
+        return
+    fi
+
+    output=$(HARNESS_REPS=${iter} ./${prog_opt}.out)
+    result=$(echo ${output} | ag -o 'result: [\d]+' | awk '{print $2}')
+    if [ ! "$result" == "$expected_result" ]
+    then
+        echo -ne "\rexpected result '${expected_result}', but got '${result}'" 1>&2
+        return
+    fi
+
+    echo ${output} | ag -o 'time: [\d]+' | awk '{print $2}'
+}
+
+# measures the loop $1 with count $2 on top of the database, and keeps the
+# count if it is the fastest so far
+try() {
+    if [ -n "${tried[$2]}" ]
+    then
+        return 1
+    fi
+
+    cp ${db} ${trial}
+    echo "$1 $2" >> ${trial}
+    time=$(measure ${trial})
+    tried[$2]=${time:-none}
+
+    s="tuning '$1' ..."
+    echo -ne "\r$(tput el)${s} count: $2 time: ${time:-failed}" 1>&2
+
+    if [ -n "$time" ] && { [ -z "$best_time" ] || [ "$time" -lt "$best_time" ]; }
+    then
+        best_time=${time}
+        best=$2
+        return 0
+    fi
+    return 1
+}
+
+autotune() {
+    prog_opt="${prog}-opt"
+    trial="${db}.trial"
+
+    # make
+    if ! err=$(make cleanprog prog PROG=${prog} 2>&1)
+    then
+        echo "initial make failed" 1>&2
+        echo $err 1>&2
+        exit 1
+    fi
+
+    expected_result=$(./${prog}-base.out | ag -o 'result: [\d]+' | awk '{print $2}')
+    touch ${db}
+
+    while true
+    do
+        # the first loop of this build without a tuned count. loops that
+        # were tuned keep their fingerprint, those that changed because an
+        # inner loop was unrolled show up again
+        cp ${db} ${trial}
+        make ${prog_opt}.out PROG=${prog} PASSCOUNT=0 \
+             PASSFLAGS="-my-unroll-db=${trial} -my-unroll-db-record" > /dev/null 2>&1
+        rm -f ${prog_opt}.ll ${prog_opt}.s ${prog_opt}.out
+        loop=$(diff ${db} ${trial} | sed -n 's/^> \(.*\) 0$/\1/p' | head -n 1)
+        if [ -z "$loop" ]
+        then
+            break
+        fi
+
+        unset tried
+        declare -A tried
+        best=""
+        best_time=""
+        worse=0
+
+        # powers of two, until there is no gain
+        for (( c = 1; c <= $count && worse < $stop; c *= 2 ))
+        do
+            if try "${loop}" ${c}
+            then
+                worse=0
+            else
+                worse=$(( worse + 1 ))
+            fi
+        done
+
+        # halfway to the neighbours of the best count
+        if [ -n "$best" ]
+        then
+            center=${best}
+            try "${loop}" $(( center * 3 / 4 ))
+            try "${loop}" $(( center * 3 / 2 ))
+        fi
+
+        echo -ne "\n" 1>&2 # end status line
+        echo "${loop} ${best:-1}" >> ${db}
+        echo "${loop}: count ${best:-1}, time ${best_time:-none}"
+    done
+
+    rm -f ${trial}
+}
+
+# Option parsing
+while getopts i:c:s:d:p: OPT
+do
+    case "$OPT" in
+        i)
+            iter=$OPTARG
+            ;;
+        c)
+            count=$OPTARG
+            ;;
+        s)
+            stop=$OPTARG
+            ;;
+        d)
+            db=$OPTARG
+            ;;
+        p)
+            prog=$OPTARG
+            autotune
+            ;;
+        \?)
+            echo 'no arguments given'
+            exit 1
+            ;;
+    esac
+done
+
+shift `expr $OPTIND - 1`
@@ -1,9 +1,17 @@
 #!/bin/bash
 
-iter=100
+# measured runs inside each program, see program/helper.h
+iter=1000
 count=100
 prog=""
 
+# prints the value of the line '<name>: <value>' of the program output, or
+# NA if the program did not report it
+field() {
+    value=$(echo "${output}" | ag -o "^$1: [\d.]+" | awk '{print $2}')
+    echo ${value:-NA}
+}
+
 benchmark() {
     prog_base="${prog}-base"
     prog_opt="${prog}-opt"
@@ -20,6 +28,14 @@ benchmark() {
         exit 1
     fi
 
+    # the optimized program for all counts, built in one process
+    if ! err=$(make variants PROG=${prog} PASSCOUNT=${count} 2>&1)
+    then
+        echo "make variants failed" 1>&2
+        echo $err 1>&2
+        exit 1
+    fi
+
     # expected result from all programs
     expected_result=$(./${prog_base}.out | ag -o 'result: [\d]+' | awk '{print $2}')
 
@@ -31,44 +47,37 @@ benchmark() {
     for prog_cur in "${prog_all[@]}"
     do
 
-        # set and clear logfile
+        # set and clear logfiles. time is the median of the runs, ci_low and
+        # ci_high bound its 95% confidence interval
         logfile="${prog_cur}.csv"
-        echo "count,time,loc" > $logfile
+        jsonfile="${prog_cur}.json"
+        echo "count,time,loc,min,stddev,ci_low,ci_high,instructions,ipc,branch_misses,l1i_misses,uops" > $logfile
+        echo "[" > $jsonfile
+        sep=""
 
         # for each unroll count
         for (( c = 1; c <= $count ; c++ ))
         do
 
+            # the optimized variants are numbered by count
+            target="${prog_cur}"
+            if [ "${prog_cur}" == "${prog_opt}" ]
+            then
+                target="${prog_opt}-${c}"
+            fi
+
             # make
-            if ! err=$(make ${prog_cur}.out PROG=${prog} PASSCOUNT=${c} 2>&1)
+            if ! err=$(make ${target}.out PROG=${prog} PASSCOUNT=${c} 2>&1)
             then
                 # echo "make failed for count ${c}" 1>&2
                 # echo $err 1>&2
                 continue;
             fi
 
-            output=""
-            tot=0
-
-            # get mean running time
-            for (( i = 1; i <= $iter ; i++ ))
-            do
-                # check if base
-                # TODO
-
-                # run prog
-                output=$(./${prog_cur}.out)
-
-                # get time
-                time=$(echo ${output} | ag -o 'time: [\d]+' | awk '{print $2}')
-                # add to total
-                tot=$(( $tot + $time ))
-
-                # print status line with percent
-                # p=$(( $i * 100 / $iter * $prog_count))
-                s="benchmarking '${prog_cur}' ..."
-                echo -ne "\r$(tput el)${s} i: $i / $iter count: $c / $count prog: ${prog_i} / ${#prog_all[@]}" 1>&2
-            done
+            # run prog, it repeats the measurement itself
+            s="benchmarking '${prog_cur}' ..."
+            echo -ne "\r$(tput el)${s} count: $c / $count prog: ${prog_i} / ${#prog_all[@]}" 1>&2
+            output=$(HARNESS_REPS=${iter} ./${target}.out)
 
             # check for correct result
             result=$(echo ${output} | ag -o 'result: [\d]+' | awk '{print $2}')
@@ -78,18 +87,32 @@ benchmark() {
                 exit 1
             fi
 
-            # calculate average
-            avg=$(( $tot / $iter ))
+            # get the summary of the runs
+            time=$(echo ${output} | ag -o 'time: [\d]+' | awk '{print $2}')
+            min=$(echo ${output} | ag -o 'min: [\d]+' | awk '{print $2}')
+            stddev=$(echo ${output} | ag -o 'stddev: [\d.]+' | awk '{print $2}')
+            ci_low=$(echo ${output} | ag -o 'ci: [\d]+ [\d]+' | awk '{print $2}')
+            ci_high=$(echo ${output} | ag -o 'ci: [\d]+ [\d]+' | awk '{print $3}')
+
+            # hardware counters per run, NA where not available
+            instructions=$(field instructions)
+            ipc=$(field ipc)
+            branch_misses=$(field branch-misses)
+            l1i_misses=$(field l1i-misses)
+            uops=$(field uops)
 
             # calculate code size
-            loc=$(wc -l < ${prog_cur}.s)
+            loc=$(wc -l < ${target}.s)
 
             # write result
             # echo -ne "\n" 1>&2 # end status line
-            echo "${c},${avg},${loc}" >> $logfile
+            echo "${c},${time},${loc},${min},${stddev},${ci_low},${ci_high},${instructions},${ipc},${branch_misses},${l1i_misses},${uops}" >> $logfile
+            echo "${sep}  {\"count\": ${c}, \"time\": ${time}, \"loc\": ${loc}, \"min\": ${min}, \"stddev\": ${stddev}, \"ci_low\": ${ci_low}, \"ci_high\": ${ci_high}, \"reps\": ${iter}, \"instructions\": ${instructions/NA/null}, \"ipc\": ${ipc/NA/null}, \"branch_misses\": ${branch_misses/NA/null}, \"l1i_misses\": ${l1i_misses/NA/null}, \"uops\": ${uops/NA/null}}" >> $jsonfile
+            sep=","
 
         done
 
+        echo "]" >> $jsonfile
         prog_i=$(( prog_i + 1 ))
     done
 }
@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# measures the time the unroll pass itself takes, as a function of the unroll
+# count and the size of the loop body. writes compiletime.csv with the columns
+# count,size,time where size is the loop size seen by the pass and time is in
+# microseconds
+
+count=100
+step=10
+sizes="10 50 100 500"
+logfile="compiletime.csv"
+
+# writes a loop with a run-time trip count and the given number of
+# statements in its body
+generate() {
+    size=$1
+
+    {
+        echo "int magic(int *a, int n)"
+        echo "{"
+        echo "    int i, x = 0;"
+        echo ""
+        echo "    for (i = 0; i < n; i++) {"
+        for (( s = 0; s < size; s++ ))
+        do
+            echo "        x = (x ^ a[i + ${s}]) * $(( s + 3 ));"
+        done
+        echo "    }"
+        echo ""
+        echo "    return x;"
+        echo "}"
+    } > compiletime-gen.c
+}
+
+compiletime() {
+    # make
+    if ! err=$(make 2>&1)
+    then
+        echo "initial make failed" 1>&2
+        echo $err 1>&2
+        exit 1
+    fi
+
+    echo "count,size,time" > $logfile
+
+    # for each body size
+    for size in ${sizes}
+    do
+        generate ${size}
+        clang -S -emit-llvm -o compiletime-gen.ll compiletime-gen.c
+        opt -S -mem2reg -simplifycfg -loops -loop-simplify -loop-rotate \
+            -o compiletime-base.ll compiletime-gen.ll > /dev/null
+
+        # for each unroll count
+        for (( c = step; c <= $count ; c += step ))
+        do
+            s="measuring compile time ..."
+            echo -ne "\r$(tput el)${s} size: ${size} count: $c / $count" 1>&2
+
+            # the pass reports "time: count = C, size = S, us = T"
+            opt -load build/libCompArch.so -my-loop-unroll -my-unroll-func magic \
+                -my-unroll-count ${c} -my-unroll-time \
+                -o /dev/null compiletime-base.ll 2>&1 \
+                | sed -n 's/.*time: count = \([0-9]*\), size = \([0-9]*\), us = \([0-9]*\)/\1,\2,\3/p' \
+                >> $logfile
+        done
+    done
+
+    echo -ne "\n" 1>&2 # end status line
+    rm -f compiletime-gen.c compiletime-gen.ll compiletime-base.ll
+}
+
+# Option parsing
+while getopts c:t:s: OPT
+do
+    case "$OPT" in
+        c)
+            count=$OPTARG
+            ;;
+        t)
+            step=$OPTARG
+            ;;
+        s)
+            sizes=$OPTARG
+            ;;
+        \?)
+            echo 'no arguments given'
+            exit 1
+            ;;
+    esac
+done
+
+shift `expr $OPTIND - 1`
+
+compiletime
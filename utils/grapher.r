@@ -36,7 +36,7 @@ total <- rbind(baseData, optData, bestData)
 
 # calculate stuff
 total.summary <- ddply(total, .(Opt, count), summarise
-                       ,time.mean = mean(time)
+                       ,time.median = median(time)
                        ## ,time.sd = sd(time),
                        )
 
@@ -45,16 +45,22 @@ total.summary <- ddply(total, .(Opt, count), summarise
 scaleX <- 10
 scaleY <- 6
 
-## mean time
+## median time of the runs inside each program, with its confidence
+## interval if the harness wrote one (see program/helper.h)
 pdf(paste0(prog, "-time.pdf"), width=scaleX, height=scaleY)
 ## tikz(paste0(prog, "-time.tex"))
-qplot(count, time.mean, data = total.summary,
-      colour = Opt, shape = Opt,
-      xlim = c(0, max(total.summary$count)),
-      ylim = c(0, max(total.summary$time)),
-      xlab = "Unroll count",
-      ylab = "Mean cycles"
-      ) + geom_line()
+timePlot <- qplot(count, time.median, data = total.summary,
+                  colour = Opt, shape = Opt,
+                  xlim = c(0, max(total.summary$count)),
+                  ylim = c(0, max(total.summary$time)),
+                  xlab = "Unroll count",
+                  ylab = "Median cycles"
+                  ) + geom_line()
+if ("ci_high" %in% names(total)) {
+    timePlot <- timePlot + geom_errorbar(aes(x = count, ymin = ci_low, ymax = ci_high, colour = Opt),
+                                         data = total, inherit.aes = FALSE, width = 0.5)
+}
+print(timePlot)
 dev.off()
 
 ## loc
@@ -68,3 +74,20 @@ qplot(count, loc, data = total,
       ylab = "LOC"
       ) + geom_line()
 dev.off()
+
+## hardware counters per run, if the harness could read them
+counterLabels <- c(instructions = "Instructions", ipc = "Instructions per cycle",
+                   branch_misses = "Branch misses", l1i_misses = "L1i misses",
+                   uops = "Uops")
+for (counter in names(counterLabels)) {
+    if (!(counter %in% names(total)) || all(is.na(total[[counter]]))) {
+        next
+    }
+    pdf(paste0(prog, "-", counter, ".pdf"), width=scaleX, height=scaleY)
+    print(qplot(total$count, total[[counter]],
+                colour = total$Opt, shape = total$Opt,
+                xlab = "Unroll count",
+                ylab = counterLabels[[counter]]
+                ) + geom_line())
+    dev.off()
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# runs utils/benchmark.sh on the kernels in program/kernel-*.c for a range of
+# data sizes. a size is the number of elements of each array (MAGIC_TRIP):
+# with int arrays the defaults fit into L1, L2 and L3, and the largest one
+# only into memory. the results of each kernel and size are written to
+# kernels/<kernel>-<size>-{base,opt,best}.{csv,json}
+
+iter=100
+count=16
+sizes="1024 16384 262144 4194304"
+kernels="kernel-dot kernel-copy kernel-gather kernel-stencil kernel-matmul kernel-search kernel-fpsum"
+dir="kernels"
+
+# Option parsing
+while getopts i:c:s:k:d: OPT
+do
+    case "$OPT" in
+        i)
+            iter=$OPTARG
+            ;;
+        c)
+            count=$OPTARG
+            ;;
+        s)
+            sizes=$OPTARG
+            ;;
+        k)
+            kernels=$OPTARG
+            ;;
+        d)
+            dir=$OPTARG
+            ;;
+        \?)
+            echo 'invalid arguments'
+            exit 1
+            ;;
+    esac
+done
+
+shift `expr $OPTIND - 1`
+
+mkdir -p ${dir}
+
+for kernel in ${kernels}
+do
+    for size in ${sizes}
+    do
+        echo "${kernel} with ${size} elements" 1>&2
+        if ! PROGTRIP=${size} $(dirname $0)/benchmark.sh -i ${iter} -c ${count} -p ${kernel}
+        then
+            echo "${kernel} failed with ${size} elements" 1>&2
+            continue
+        fi
+        echo -ne "\n" 1>&2 # end status line
+
+        for variant in base opt best
+        do
+            mv ${kernel}-${variant}.csv ${dir}/${kernel}-${size}-${variant}.csv
+            mv ${kernel}-${variant}.json ${dir}/${kernel}-${size}-${variant}.json
+        done
+    done
+done